@@ -0,0 +1,96 @@
+#ifndef _PORGI_ARENA_H_
+#define _PORGI_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* A bump-pointer allocator for request-scoped objects. Memory is handed out from large blocks and
+ * only given back all at once by reset(), which also runs the destructors of objects made with create().
+ * An arena is not thread-safe: only one thread may allocate from it at a time. */
+class Arena {
+public:
+    static const size_t BLOCK_SIZE = 4096;
+
+    explicit Arena(size_t block_size = BLOCK_SIZE);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        T* obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            add_destructor(obj, [](void* p) { static_cast<T*>(p)->~T(); });
+        }
+        return obj;
+    }
+
+    /* destroy everything created in the arena and rewind it, keeping the first block for reuse */
+    void reset();
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+    };
+    /* block header rounded up so that the data after it is suitably aligned */
+    static const size_t HEADER_SIZE;
+
+    struct Destructor {
+        Destructor* next;
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    size_t block_size;
+    Block* blocks;
+    uint8_t* cursor;
+    uint8_t* limit;
+    Destructor* destructors;
+
+    void* allocate_slow(size_t size, size_t align);
+    void add_destructor(void* object, void (*destroy)(void*));
+    void free_blocks(Block* block);
+};
+
+/* A standard allocator that draws from an Arena, or from the global heap when there is no arena */
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator(Arena* arena = nullptr) noexcept : arena(arena) { }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) { }
+
+    T* allocate(size_t n)
+    {
+        if (arena) {
+            return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t) noexcept
+    {
+        if (!arena) {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& rhs) const { return arena == rhs.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& rhs) const { return arena != rhs.arena; }
+
+    Arena* arena;
+};
+
+#endif
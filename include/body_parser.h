@@ -0,0 +1,62 @@
+#ifndef _PORGI_BODY_PARSER_H_
+#define _PORGI_BODY_PARSER_H_
+
+#include "byte_buffer.h"
+#include "exceptions.h"
+#include "request_body.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/* Frames the body of a request in the connection's input buffer, by its Content-Length or by the chunked
+ * transfer coding, and moves the body bytes into a RequestBody as they arrive. */
+class BodyParser {
+public:
+    PORGI_DEF_ERROR(InvalidChunk);
+    PORGI_DEF_ERROR(BodyTooLarge);
+
+    /* upper bound on the chunk extensions of a chunk and on the trailer section, which are skipped */
+    static const size_t MAX_SKIPPED_SIZE = 8192;
+
+    enum class ParseStatus {
+        NEED_MORE,
+        COMPLETE,
+    };
+
+    BodyParser() : state(State::LENGTH), remaining(0), max_size(0), received(0), skipped(0) { }
+
+    /* a body of exactly length bytes */
+    void start_length(uint64_t length);
+    /* a chunked body, BodyTooLarge is thrown as soon as it is known to exceed max_size */
+    void start_chunked(uint64_t max_size);
+
+    /* Like HttpParser::parse_http: resume at offset in req_buf and move what belongs to the body into body.
+     * On COMPLETE, offset is set to the first byte after the body; on NEED_MORE, all bytes are consumed. */
+    ParseStatus parse_body(const ByteBuffer& req_buf, size_t& offset, RequestBody& body);
+
+private:
+    enum class State {
+        LENGTH,
+        CHUNK_SIZE_START,
+        CHUNK_SIZE,
+        CHUNK_EXTENSION,
+        CHUNK_SIZE_ALMOST_DONE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        CHUNK_DATA_ALMOST_DONE,
+        TRAILER_START,
+        TRAILER,
+        TRAILER_ALMOST_DONE,
+    };
+
+    State state;
+    /* bytes left of the body or of the current chunk */
+    uint64_t remaining;
+    uint64_t max_size;
+    uint64_t received;
+    size_t skipped;
+
+    void end_chunk_size();
+};
+
+#endif
@@ -4,19 +4,34 @@
 #include "easylogging++.h"
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <string>
 
+class Arena;
+
+/* word-at-a-time hash (wyhash) */
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed = 0);
+
+/* A growable byte array. Contents up to INLINE_CAPACITY bytes are stored inside the object itself,
+ * so short values such as header names never touch the heap. A buffer can also be given an arena to
+ * take its storage from, which is then never freed individually. Copies of such a buffer go back to the heap. */
 class ByteBuffer {
 public:
+    static const size_t INLINE_CAPACITY = 24;
+
     explicit ByteBuffer(size_t capacity = 0);
     explicit ByteBuffer(size_t size, uint8_t fill);
     explicit ByteBuffer(const void* buf, size_t size) : ByteBuffer(buf, size, size) { }
     explicit ByteBuffer(const void* buf, size_t size, size_t capacity);
     explicit ByteBuffer(const std::string& str) : ByteBuffer(str.c_str(), str.length()) { }
+    explicit ByteBuffer(Arena* arena);
+    explicit ByteBuffer(const void* buf, size_t size, Arena* arena);
 
-    ByteBuffer(const ByteBuffer& other) : ByteBuffer(other._data.get(), other._size, other._capacity) { }
-    ByteBuffer(ByteBuffer&& other) { swap(other); }
+    ByteBuffer(const ByteBuffer& other) : ByteBuffer(other._data, other._size) { }
+    ByteBuffer(ByteBuffer&& other) noexcept;
+    ~ByteBuffer();
 
     ByteBuffer& operator=(const ByteBuffer& rhs);
     ByteBuffer& operator=(ByteBuffer&& rhs) noexcept;
@@ -26,22 +41,30 @@ public:
     uint8_t& operator[](size_t index) { return _data[index]; }
     uint8_t operator[](size_t index) const { return _data[index]; }
 
-    uint8_t* begin() { return _data.get(); }
-    const uint8_t* begin() const { return _data.get(); }
-    uint8_t* end() { return _data.get() + _size; }
-    const uint8_t* end() const { return _data.get() + _size; }
+    uint8_t* begin() { return _data; }
+    const uint8_t* begin() const { return _data; }
+    uint8_t* end() { return _data + _size; }
+    const uint8_t* end() const { return _data + _size; }
 
-    uint8_t* data() { return _data.get(); }
-    const uint8_t* data() const { return _data.get(); }
+    uint8_t* data() { return _data; }
+    const uint8_t* data() const { return _data; }
     std::string to_string() const { return std::string(reinterpret_cast<const char*>(data()), size()); }
 
     size_t size() const { return _size; }
     size_t capacity() const { return _capacity; }
+    Arena* get_arena() const { return _arena; }
 
     void append(const void* buf, size_t append_size);
-    void append(const ByteBuffer& rhs) { append(rhs._data.get(), rhs._size); }
+    void append(const ByteBuffer& rhs) { append(rhs._data, rhs._size); }
+    /* the decimal digits of value, written in place */
+    void append_decimal(uint64_t value);
 
-    void clear();
+    /* empty the buffer but keep its storage for reuse */
+    void clear() { _size = 0; }
+    /* release the storage that is not needed for the current contents */
+    void shrink();
+    /* drop the first count bytes, moving the rest to the front */
+    void consume(size_t count);
 
     template <typename... T>
     void append(ByteBuffer buffer, T&& ... buffers)
@@ -51,14 +74,18 @@ public:
     }
 
 private:
-    size_t _capacity{};
-    size_t _size{};
-    std::unique_ptr<uint8_t[]> _data;
+    size_t _capacity;
+    size_t _size;
+    uint8_t* _data;
+    Arena* _arena;
+    uint8_t _inline[INLINE_CAPACITY];
 
     static void append(); 
+    bool is_inline() const { return _data == _inline; }
     void allocate(size_t capacity);
+    uint8_t* allocate_storage(size_t capacity);
+    void release();
     void extend(size_t new_capacity);
-    void swap(ByteBuffer& rhs);
 };
 
 inline MAKE_LOGGABLE(ByteBuffer, buffer, os) {
@@ -78,12 +105,7 @@ namespace std {
   {
     std::size_t operator()(const ByteBuffer& buf) const
     {
-        size_t result = 0;
-        const size_t prime = 31;
-        for (size_t i = 0; i < buf.size(); ++i) {
-            result = buf.data()[i] + (result * prime);
-        }
-        return result;
+        return (std::size_t) hash_bytes(buf.data(), buf.size());
     }
   };
 }
@@ -0,0 +1,52 @@
+#ifndef _PORGI_COMPLETION_QUEUE_H_
+#define _PORGI_COMPLETION_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+/* Work finished on another thread, e.g. a response produced by a worker, that has to be taken over by
+ * the reactor owning the connection it belongs to. */
+class Completion {
+public:
+    virtual ~Completion() { }
+
+    /* called on the reactor thread */
+    virtual void complete() = 0;
+
+private:
+    friend class CompletionQueue;
+    Completion* next;
+};
+
+/* A lock-free multi-producer, single-consumer queue of completions for one reactor. Any thread may post,
+ * and an eventfd in the reactor's epoll set wakes the reactor, which then runs everything posted so far
+ * in one go. Only the post that finds the queue empty writes to the eventfd. */
+class CompletionQueue {
+public:
+    CompletionQueue();
+    ~CompletionQueue();
+
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    /* to be registered for EPOLLIN in the reactor's epoll set */
+    int get_fd() const { return event_fd; }
+
+    /* the calling thread becomes the one that drains the queue */
+    void bind_to_current_thread() { owner = std::this_thread::get_id(); }
+    /* whether the caller is the reactor thread, which can complete its work right away */
+    bool on_owner_thread() const { return std::this_thread::get_id() == owner; }
+
+    /* thread-safe, the queue takes ownership of completion */
+    void post(Completion* completion);
+    /* complete and delete everything posted so far in the order it was posted, returns how many there were */
+    size_t drain();
+
+private:
+    std::atomic<Completion*> head;
+    int event_fd;
+    std::thread::id owner;
+};
+
+#endif
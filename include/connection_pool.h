@@ -0,0 +1,50 @@
+#ifndef _PORGI_CONNECTION_POOL_H_
+#define _PORGI_CONNECTION_POOL_H_
+
+#include "http_connection.h"
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+/* A fixed-size slab of connection objects owned by one reactor. Slots are handed out and reclaimed
+ * on the reactor thread. The last reference to a connection may be dropped on any thread, in which
+ * case its slot is queued and only reclaimed by the next collect(). */
+class ConnectionPool {
+public:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    explicit ConnectionPool(size_t capacity);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    size_t get_capacity() const { return capacity; }
+    size_t get_size() const { return nused; }
+
+    /* returns nullptr if every slot is in use */
+    HttpConnection* acquire(HttpServer* server, IoBackend* backend, CompletionQueue* completions, int fd);
+    /* thread-safe */
+    void recycle(HttpConnection* conn);
+    /* destroy the recycled connections and put their slots back on the free list */
+    void collect();
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        typename std::aligned_storage<sizeof(HttpConnection), alignof(HttpConnection)>::type storage;
+        Slot* next;
+        bool in_use;
+
+        HttpConnection* get() { return reinterpret_cast<HttpConnection*>(&storage); }
+    };
+
+    size_t capacity;
+    size_t nused;
+    Slot* slots;
+    Slot* free_list;
+    /* slots released by other threads, waiting for collect() */
+    std::atomic<Slot*> recycled;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _PORGI_EPOLL_BACKEND_H_
+#define _PORGI_EPOLL_BACKEND_H_
+
+#include "io_backend.h"
+
+#include <memory>
+#include <sys/epoll.h>
+
+/* Edge-triggered epoll, with a read, writev or sendfile system call for every operation once the
+ * socket is ready for it. */
+class EpollBackend : public IoBackend {
+public:
+    static const size_t MAX_EVENTS = 1024;
+
+    EpollBackend(Reactor* reactor, int listen_fd, bool shared_listen_fd, CompletionQueue* completions);
+    ~EpollBackend();
+
+    void start() override { }
+    void poll() override;
+
+    void add_connection(HttpConnection* conn) override;
+    ssize_t write(HttpConnection* conn, OutputQueue& out, bool last) override;
+    void pause_input(HttpConnection* conn) override;
+    void resume_input(HttpConnection* conn) override;
+    void close(HttpConnection* conn) override;
+
+private:
+    Reactor* reactor;
+    int listen_fd;
+    int epfd;
+    CompletionQueue* completions;
+    std::unique_ptr<struct epoll_event[]> events;
+
+    static const int EPOLL_FLAGS = 0;
+
+    void handle_accept();
+    void set_cork(int fd, bool on);
+    void epoll_add(int fd, struct epoll_event* event);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _PORGI_FILE_CACHE_H_
+#define _PORGI_FILE_CACHE_H_
+
+#include "http_date.h"
+
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+
+/* An open file together with what stat said about it when it was opened. The descriptor is closed
+ * with the last reference, so a file evicted from the cache stays readable for the responses that
+ * are still sending it. */
+struct OpenFile {
+    int fd;
+    struct stat st;
+    /* st_mtime as an HTTP date */
+    char last_modified[HTTP_DATE_LENGTH];
+
+    OpenFile(int fd, const struct stat& st);
+    ~OpenFile();
+
+    OpenFile(const OpenFile&) = delete;
+    OpenFile& operator=(const OpenFile&) = delete;
+};
+
+/* An LRU cache of open files keyed by path, shared by all reactors. Cached entries are trusted for
+ * REVALIDATE_INTERVAL and then checked against the file system again, so replaced files are picked up. */
+class FileCache {
+public:
+    static const size_t DEFAULT_CAPACITY = 256;
+    static constexpr std::chrono::milliseconds REVALIDATE_INTERVAL{1000};
+
+    explicit FileCache(size_t capacity = DEFAULT_CAPACITY) : capacity(capacity) { }
+
+    /* returns nullptr with errno set if path cannot be opened, EISDIR if it is a directory */
+    std::shared_ptr<const OpenFile> open(const std::string& path);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string path;
+        std::shared_ptr<const OpenFile> file;
+        Clock::time_point checked;
+    };
+
+    size_t capacity;
+    std::mutex mutex;
+    /* most recently used first */
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+    static std::shared_ptr<const OpenFile> open_file(const std::string& path);
+};
+
+#endif
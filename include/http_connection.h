@@ -1,46 +1,171 @@
 #ifndef _PORGI_HTTP_CONNECTION_H_
 #define _PORGI_HTTP_CONNECTION_H_
 
+#include "arena.h"
+#include "body_parser.h"
 #include "byte_buffer.h"
+#include "completion_queue.h"
 #include "http_request.h"
 #include "http_parser.h"
 #include "http_server.h"
+#include "io_backend.h"
+#include "output_queue.h"
+#include "response_cache.h"
+#include "response_stream.h"
 
+#include <atomic>
 #include <cstddef>
+#include <deque>
 
+class ConnectionPool;
+
+/* A client connection, living in a slot of its reactor's ConnectionPool. It is reference counted:
+ * the reactor holds a reference until the connection is closed and every request being handled by
+ * a worker holds another, so the slot is only reclaimed once nothing can touch it anymore.
+ * Only the reactor thread touches the socket and the state of the connection; workers hand their
+ * responses and the pieces of streamed bodies back through the reactor's CompletionQueue. */
 class HttpConnection {
 public:
-    HttpConnection(HttpServer* server, int epfd, int fd);
+    HttpConnection(HttpServer* server, ConnectionPool* pool, IoBackend* backend, CompletionQueue* completions, int fd);
 
     int get_fd() const { return fd; }
+    bool is_closed() const { return closed; }
+    /* too much output is backed up, no more requests are read until it has drained */
+    bool is_input_paused() const { return input_paused; }
+    IoState& get_io_state() { return io_state; }
+
+    /* fails once the last reference is gone and the connection is waiting to be reclaimed */
+    bool retain();
+    void release();
 
+    /* the socket is readable or writable, for backends that report readiness */
     void handle_read_event();
     void handle_write_event();
-    void handle_response(const HttpResponse& response);
-    void handle_bad_request();
-    void handle_internal_error();
+    /* for backends that report completions: len bytes have been received, 0 at the end of the input */
+    void handle_input(const void* data, size_t len);
+    /* nwritten bytes of the output have been written asynchronously */
+    void handle_written(size_t nwritten);
+
+    /* a canned 400, 404, 413 or 500 (for any other code) whose wire format is built once and shared */
+    static HttpResponse make_error_response(int status_code);
+    /* the wire format of response, to be sent on any connection; nullptr for file and streamed responses */
+    static std::shared_ptr<const SerializedResponse> serialize_response(const HttpResponse& response);
 
     void close();
 
 private:
-    int epfd, fd;
+    /* A response slot for one pipelined request. Slots are queued in request order and written once
+     * every slot before them has been written. */
+    struct PendingResponse {
+        explicit PendingResponse(Arena* arena) : uri(arena) { }
+
+        HttpMethod method;
+        ByteBuffer uri;
+        uint16_t http_major, http_minor;
+        bool keep_alive;
+        bool ready;
+        OutputQueue data;
+        /* the body still being produced; chunked unless the client only speaks HTTP/1.0 */
+        std::shared_ptr<ResponseStream> stream;
+        bool chunked;
+        /* waiting for the client to catch up, no worker is producing it */
+        bool stream_paused;
+        /* a worker is writing a batch of the request body to its file */
+        bool spill_writing;
+        /* the body has been received, the request goes out once all of it has been written */
+        bool body_complete;
+    };
+
+    struct ResponseCompletion;
+    struct StreamCompletion;
+    struct SpillCompletion;
+
+    int fd;
     HttpServer* server;
+    ConnectionPool* pool;
+    IoBackend* backend;
+    CompletionQueue* completions;
+    IoState io_state;
+    std::atomic<int> refs;
     ByteBuffer req_buffer;
-    HttpRequest request;
-    HttpResponse response;
+    size_t req_offset;
+    HttpRequestView request;
     HttpParser http_parser;
-    bool keep_alive;
+    bool read_closed;
+    /* Request-scoped storage: materialized requests, their captures and the slots' URIs. Only the
+     * reactor allocates from it, after queueing a slot, and it is reset once no slot is pending. */
+    Arena arena;
+    /* the request whose body is being received, it is dispatched once the body is complete */
+    HttpRequest* body_request;
+    PendingResponse* body_slot;
+    BodyParser body_parser;
 
-    ByteBuffer resp_head;
-    size_t resp_body_offset, resp_body_rem;
-    size_t resp_head_offset, resp_head_rem;
+    std::deque<PendingResponse> pending;
+    OutputQueue out_queue;
+    bool close_after_write;
+    /* a stream failed, nothing after what has been queued goes out */
+    bool cut_short;
+    bool input_paused;
+    bool closed;
 
     static const size_t CHUNK_SIZE = 4096;
+    /* upper bound on a buffered request head before it is rejected */
+    static const size_t MAX_REQUEST_SIZE = 65536;
+    /* input is parsed whenever this much has been read */
+    static const size_t MAX_READ_SIZE = 262144;
+    /* idle buffers larger than this give their storage back */
+    static const size_t RETAINED_BUFFER_SIZE = 16384;
+    /* bodies up to this size are copied behind the head instead of taking a segment of their own */
+    static const size_t COALESCE_BODY_SIZE = 1024;
+    /* a stream is asked for this much at a time, and paused while more than the high-water mark is queued
+     * for the connection until the queue has drained below the low-water mark */
+    static const size_t STREAM_PIECE_SIZE = 65536;
+    static const size_t STREAM_HIGH_WATER = 262144;
+    static const size_t STREAM_LOW_WATER = 65536;
+    /* A client that pipelines requests without reading the responses is not read from while this many
+     * responses are pending or this much output is queued, until every response has been queued, which
+     * frees the arena, and the output is below the low-water mark. */
+    static const size_t MAX_PENDING_RESPONSES = 64;
+    static const size_t OUTPUT_HIGH_WATER = 1048576;
+    static const size_t OUTPUT_LOW_WATER = 262144;
+    /* the part of a body past its memory limit is handed to a worker in batches of this size, and the
+     * input is paused while more than the high-water mark of it waits for the file */
+    static const size_t SPILL_BATCH_SIZE = 262144;
+    static const size_t SPILL_HIGH_WATER = 1048576;
 
-    void build_resp_head(const HttpResponse& response, ByteBuffer& buf);
-    void reset();
+    /* read until the socket is drained, returning true, or MAX_READ_SIZE bytes are buffered */
+    bool read_input();
+    /* dispatch every complete request in the buffer */
+    void process_input();
+    /* close once the client has stopped sending and there is nothing left to answer */
+    void check_read_closed();
+    /* parse what has been buffered while the input was paused and have the backend read again */
+    void resume_input();
+    bool is_keep_alive(const HttpRequestView& request) const;
+    /* how the body of request is delimited; false if that cannot be told safely */
+    bool frame_body(const HttpRequestView& request, bool& chunked, uint64_t& length) const;
+    PendingResponse* add_pending(const HttpRequestView* request, bool keep_alive);
+    void dispatch(HttpRequest* request, PendingResponse* slot);
+    /* the body of request has been received, it is dispatched once its spilled part has been written */
+    void finish_body(HttpRequest* request, PendingResponse* slot);
+    /* have a worker write the next batch of the spilled part of the body */
+    void write_spill(HttpRequest* request, PendingResponse* slot);
+    void spill_written(HttpRequest* request, PendingResponse* slot, bool failed);
+    /* answer the request of slot with an error and stop reading, the rest of the input cannot be framed */
+    void reject_request(PendingResponse* slot, int status_code);
+    void handle_response(PendingResponse* slot, HttpResponse&& response);
+    static void build_resp_head(const HttpResponse& response, bool keep_alive, ByteBuffer& buf);
+    /* the head up to the Connection header, and what follows it */
+    static void build_status_line(const HttpResponse& response, ByteBuffer& buf);
+    static void build_resp_fields(const HttpResponse& response, ByteBuffer& buf);
+    void flush_responses();
+    /* have a worker produce the next piece of the slot's stream */
+    void schedule_stream(PendingResponse* slot);
+    /* queue a piece produced by the worker, more is false once the stream is complete */
+    void append_stream(PendingResponse* slot, OutputQueue& body, bool more, bool failed);
+    void do_close();
 
-    void handle_unmatched_url();
+    void handle_bad_request();
 };
 
 #endif
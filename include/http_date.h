@@ -0,0 +1,15 @@
+#ifndef _PORGI_HTTP_DATE_H_
+#define _PORGI_HTTP_DATE_H_
+
+#include <cstddef>
+#include <ctime>
+
+/* length of an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT" */
+static const size_t HTTP_DATE_LENGTH = 29;
+
+/* writes exactly HTTP_DATE_LENGTH characters, without a terminating NUL */
+void format_http_date(time_t t, char* buf);
+/* only IMF-fixdate is understood, the obsolete RFC 850 and asctime forms are rejected */
+bool parse_http_date(const char* str, size_t len, time_t& t);
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef _PORGI_HTTP_HEADERS_H_
+#define _PORGI_HTTP_HEADERS_H_
+
+#include "arena.h"
+#include "byte_buffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/* Well-known header names, interned at parse time so they can be looked up without string compares */
+enum class HeaderId : uint8_t {
+    OTHER = 0,
+    ACCEPT,
+    ACCEPT_ENCODING,
+    ACCEPT_LANGUAGE,
+    AUTHORIZATION,
+    CACHE_CONTROL,
+    CONNECTION,
+    CONTENT_ENCODING,
+    CONTENT_LENGTH,
+    CONTENT_TYPE,
+    COOKIE,
+    DATE,
+    EXPECT,
+    HOST,
+    IF_MODIFIED_SINCE,
+    IF_NONE_MATCH,
+    IF_RANGE,
+    LAST_MODIFIED,
+    ORIGIN,
+    RANGE,
+    REFERER,
+    TRANSFER_ENCODING,
+    UPGRADE,
+    USER_AGENT,
+    X_FORWARDED_FOR,
+    COUNT,
+};
+
+/* case-insensitive, returns HeaderId::OTHER for names that are not well-known */
+HeaderId lookup_header_id(const void* name, size_t len);
+const char* header_id_name(HeaderId id);
+
+/* A flat header store that keeps the first INLINE_ENTRIES headers inline and looks up well-known
+ * headers in O(1) by id. Names compare case-insensitively and setting an existing name replaces it.
+ * Given an arena, the names, values and overflow entries are allocated from it; copies use the heap. */
+class HeaderMap {
+public:
+    struct Entry {
+        HeaderId id;
+        ByteBuffer name;
+        ByteBuffer value;
+    };
+
+    static const size_t INLINE_ENTRIES = 16;
+
+    class const_iterator {
+    public:
+        const_iterator(const HeaderMap* map, size_t index) : map(map), index(index) { }
+
+        const Entry& operator*() const { return map->entry(index); }
+        const Entry* operator->() const { return &map->entry(index); }
+        const_iterator& operator++() { ++index; return *this; }
+        bool operator==(const const_iterator& rhs) const { return index == rhs.index; }
+        bool operator!=(const const_iterator& rhs) const { return index != rhs.index; }
+
+    private:
+        const HeaderMap* map;
+        size_t index;
+    };
+
+    explicit HeaderMap(Arena* arena = nullptr);
+    HeaderMap(const HeaderMap& other);
+    HeaderMap(HeaderMap&& other) noexcept;
+    ~HeaderMap();
+
+    HeaderMap& operator=(const HeaderMap& rhs);
+    HeaderMap& operator=(HeaderMap&& rhs) noexcept;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    const ByteBuffer* get(HeaderId id) const;
+    const ByteBuffer* get(const void* name, size_t len) const;
+    const ByteBuffer* get(const ByteBuffer& name) const { return get(name.data(), name.size()); }
+    bool contains(const ByteBuffer& name) const { return get(name) != nullptr; }
+
+    /* insert or replace, with the id already known to the caller */
+    void set(HeaderId id, const ByteBuffer& name, const ByteBuffer& value)
+    {
+        set(id, name.data(), name.size(), value.data(), value.size());
+    }
+    void set(HeaderId id, const void* name, size_t name_len, const void* value, size_t value_len);
+    /* a well-known header under its canonical name */
+    void set(HeaderId id, const void* value, size_t value_len);
+    void set(const ByteBuffer& name, const ByteBuffer& value);
+    /* the value for name, inserting an empty one if it is absent */
+    ByteBuffer& operator[](const ByteBuffer& name);
+    bool erase(const ByteBuffer& name);
+
+    void clear();
+
+private:
+    Arena* arena;
+    size_t count;
+    /* index + 1 of the entry for each well-known id, 0 if absent */
+    uint16_t by_id[(size_t) HeaderId::COUNT];
+    alignas(Entry) unsigned char inline_storage[INLINE_ENTRIES * sizeof(Entry)];
+    std::vector<Entry, ArenaAllocator<Entry>> overflow;
+
+    Entry& entry(size_t index);
+    const Entry& entry(size_t index) const;
+    Entry* inline_entries() { return reinterpret_cast<Entry*>(inline_storage); }
+    const Entry* inline_entries() const { return reinterpret_cast<const Entry*>(inline_storage); }
+
+    int find(HeaderId id, const void* name, size_t len) const;
+    Entry& append(HeaderId id, const void* name, size_t name_len, const void* value, size_t value_len);
+    void reindex();
+};
+
+#endif
@@ -14,9 +14,25 @@ public:
     PORGI_DEF_ERROR(InvalidVersion);
     PORGI_DEF_ERROR(LFExpected);
     PORGI_DEF_ERROR(InvalidHeader);
+    PORGI_DEF_ERROR(TooManyHeaders);
+
+    enum class ParseStatus {
+        NEED_MORE,
+        COMPLETE,
+    };
+
+    /* no known method is longer */
+    static const uint32_t MAX_METHOD_LENGTH = 7;
 
     HttpParser();
-    void parse_http(const ByteBuffer& req_buf, HttpRequest& request);
+
+    /* Resume parsing req_buf at offset. On COMPLETE, offset is set to the first byte after the request;
+     * on NEED_MORE, all bytes are consumed and parsing continues from the saved state on the next call.
+     * Malformed input is reported by throwing one of the errors above.
+     * The request is recorded as slices of req_buf and nothing is copied or allocated. If the bytes
+     * before request.start are dropped from req_buf between calls, request.start must be adjusted. */
+    ParseStatus parse_http(const ByteBuffer& req_buf, size_t& offset, HttpRequestView& request);
+    void reset();
 
 private:
     enum class RequestParseState {
@@ -47,13 +63,12 @@ private:
     };
 
     RequestParseState state;
-    HttpMethod method;
-    size_t method_index;
-    ByteBuffer uri_buffer;
-    ByteBuffer last_header_name;
-    ByteBuffer last_header_value;
+    uint32_t token_start;
+    uint32_t value_end;
 
     RequestParseState parse_uri_char(char ch);
+    const uint8_t* skip_header_value(const ByteBuffer& req_buf, const uint8_t* p, HttpRequestView& request);
+    void add_header(HttpRequestView& request);
 };
 
 #endif
@@ -2,41 +2,138 @@
 #define _PORGI_HTTP_REQUEST_H_
 
 #include "byte_buffer.h"
+#include "http_headers.h"
+#include "request_body.h"
 
+#include <cstddef>
 #include <cstdint>
-#include <map>
+#include <memory>
 
 enum class HttpMethod {
     UNKNOWN = 0,
     GET = 1,
+    HEAD,
+    POST,
+    PUT,
+    PATCH,
+    DELETE,
+    COUNT,
 };
 
 static inline char const* http_method_name(HttpMethod met)
 {
     switch (met) {
-    case HttpMethod::UNKNOWN:
-        return "UNKNOWN";
     case HttpMethod::GET:
         return "GET";
+    case HttpMethod::HEAD:
+        return "HEAD";
+    case HttpMethod::POST:
+        return "POST";
+    case HttpMethod::PUT:
+        return "PUT";
+    case HttpMethod::PATCH:
+        return "PATCH";
+    case HttpMethod::DELETE:
+        return "DELETE";
+    default:
+        return "UNKNOWN";
     }
 }
 
-using HeaderMap = std::map<ByteBuffer, ByteBuffer>;
+/* case-sensitive like the method token itself, returns HttpMethod::UNKNOWN for anything else */
+HttpMethod lookup_http_method(const void* name, size_t len);
 
+/* A request that owns its data. With an arena, all of its storage comes from there. */
 struct HttpRequest {
+    explicit HttpRequest(Arena* arena = nullptr)
+        : method(HttpMethod::UNKNOWN), uri(arena), query_string(arena), http_major(0), http_minor(0), headers(arena)
+    {
+    }
+
     HttpMethod method;
     ByteBuffer uri;
+    ByteBuffer query_string;
 
     uint16_t http_major;
     uint16_t http_minor;
 
     HeaderMap headers;
+    /* empty unless the request had a body */
+    RequestBody body;
+};
+
+/* A byte range of a request, relative to the first byte of the request in the input buffer */
+struct Slice {
+    uint32_t offset;
+    uint32_t length;
 };
 
+/* A parsed request that refers into the connection's input buffer instead of owning its data.
+ * It is only valid as long as the bytes it was parsed from stay in place. */
+struct HttpRequestView {
+    static const size_t MAX_HEADERS = 64;
+
+    struct Header {
+        HeaderId id;
+        Slice name;
+        Slice value;
+    };
+
+    size_t start;
+    HttpMethod method;
+    Slice uri;
+    Slice query_string;
+
+    uint16_t http_major;
+    uint16_t http_minor;
+
+    size_t num_headers;
+    Header headers[MAX_HEADERS];
+    /* index + 1 of the first header with each well-known id, 0 if absent */
+    uint8_t header_index[(size_t) HeaderId::COUNT];
+
+    const uint8_t* base(const ByteBuffer& buf) const { return buf.data() + start; }
+    ByteBuffer get(const ByteBuffer& buf, Slice slice) const { return ByteBuffer(base(buf) + slice.offset, slice.length); }
+
+    /* header lookup, returns nullptr if the header is absent */
+    const Header* find_header(HeaderId id) const
+    {
+        auto index = header_index[(size_t) id];
+        return index ? &headers[index - 1] : nullptr;
+    }
+    /* case-insensitive */
+    const Header* find_header(const ByteBuffer& buf, const char* name, size_t name_len) const;
+    /* whether the comma-separated header value lists token, case-insensitively */
+    bool header_has_token(const ByteBuffer& buf, const Header* header, const char* token, size_t token_len) const;
+
+    /* copy the request out of the input buffer, into storage of request's own allocator */
+    void materialize(const ByteBuffer& buf, HttpRequest& request) const;
+};
+
+struct OpenFile;
+struct SerializedResponse;
+class ResponseStream;
+
 struct HttpResponse {
     int status_code;
     HeaderMap headers;
     ByteBuffer body;
+
+    /* memory owned by body_owner, e.g. a Python object, sent after body without being copied */
+    std::shared_ptr<const void> body_owner;
+    const uint8_t* body_data = nullptr;
+    size_t body_length = 0;
+
+    /* a region of a file sent after body, straight from the page cache */
+    std::shared_ptr<const OpenFile> file;
+    size_t file_offset = 0;
+    size_t file_length = 0;
+    /* if set, the body is whatever the stream produces, sent after body as it comes */
+    std::shared_ptr<ResponseStream> stream;
+    /* if set, the response in wire format and nothing else is used */
+    std::shared_ptr<const SerializedResponse> serialized;
+
+    size_t content_length() const { return body.size() + body_length + (file ? file_length : 0); }
 };
 
 namespace std {
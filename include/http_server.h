@@ -1,45 +1,105 @@
 #ifndef _PORGI_HTTP_SERVER_H_
 #define _PORGI_HTTP_SERVER_H_
 
+#include "file_cache.h"
+#include "io_backend.h"
+#include "response_cache.h"
 #include "route.h"
 #include "script_interface.h"
 
 #include "ctpl/ctpl.h"
 
 #include <string>
-
-class HttpConnection;
+#include <vector>
 
 class HttpServer {
 public:
     typedef uint16_t Port;
 
     static const size_t MAX_CONNECTIONS = 1024;
-    static const size_t MAX_EVENTS = 1024;
+    static const int DEFAULT_BACKLOG = 1024;
+    static const size_t DEFAULT_MAX_BODY_SIZE = 16 << 20;
+
+    HttpServer(const std::string& host, Port port, ScriptInterface* script_interface, int ncpus,
+               int backlog = DEFAULT_BACKLOG);
+
+    const std::string& get_host() const { return host; }
+    Port get_port() const { return port; }
+    int get_backlog() const { return backlog; }
 
-    HttpServer(const std::string& host, Port port, ScriptInterface* script_interface, int ncpus, int backlog = 1024);
+    /* run nreactors independent event loops, optionally pinning reactor i to cpu i */
+    void set_reactors(int nreactors, bool pin_cpus = false);
+    /* listening sockets inherited from a supervising process, one for each reactor */
+    void set_listen_fds(const std::vector<int>& listen_fds);
+    /* limit on open connections, split evenly among the reactors */
+    void set_max_connections(size_t max_connections);
+    size_t get_max_connections() const { return max_connections; }
+    /* memory limit for the responses of cacheable routes */
+    void set_response_cache_size(size_t bytes) { response_cache.set_capacity(bytes); }
+    const ResponseCache& get_response_cache() const { return response_cache; }
+    /* requests with a larger body are answered with 413 Payload Too Large */
+    void set_max_body_size(size_t bytes) { max_body_size = bytes; }
+    size_t get_max_body_size() const { return max_body_size; }
+    /* the part of a request body that is kept in memory, the rest goes to a temporary file */
+    void set_body_buffer_size(size_t bytes) { body_buffer_size = bytes; }
+    size_t get_body_buffer_size() const { return body_buffer_size; }
+    /* how the reactors do their I/O, epoll unless told otherwise */
+    void set_io_backend(IoBackend::Type type) { io_backend = type; }
+    IoBackend::Type get_io_backend() const { return io_backend; }
 
     void start_main_loop();
 
-    using RequestCallback = std::function<void(const HttpResponse&)>;
-    void dispatch_request(HttpConnection& conn, HttpRequest request, RequestCallback&& callback);
+    /* Requests that reach a script handler on the same reactor in one round of events are handed to a
+     * single worker in batches of up to batch_size, which runs their handlers back to back. Defaults to 1. */
+    void set_batch_size(size_t batch_size);
 
-    void register_url_rule(const ByteBuffer& rule, UrlMap::RequestHandler&& handler, const std::vector<HttpMethod>& methods);
+    using RequestCallback = UrlMap::ResponseCallback;
+    /* request must stay alive in arena until callback has been called */
+    void dispatch_request(const HttpRequest& request, Arena& arena, RequestCallback&& callback);
+    /* hand the requests batched on this thread over to a worker, called by the reactors after every round of events */
+    void flush_dispatch();
+    /* run task on a worker, for work that may block or enter the script */
+    void run_on_worker(std::function<void()>&& task);
+
+    void register_url_rule(const ByteBuffer& rule, const UrlMap::Route& route, const std::vector<HttpMethod>& methods);
+    /* serve the files below directory under the URL prefix */
+    void register_static(const ByteBuffer& prefix, const std::string& directory);
 
 private:
+    /* a request waiting for its handler to be called */
+    struct HandlerCall {
+        const UrlMap::Route* route;
+        const HttpRequest* request;
+        const UrlMap::UrlParams* params;
+        ByteBuffer* cache_key;
+        uint64_t cache_hash;
+        RequestCallback callback;
+        HttpResponse response;
+    };
+    using CallBatch = std::vector<HandlerCall>;
+
     std::string host;
     Port port;
     int backlog;
     ScriptInterface* script_interface;
     ctpl::thread_pool thread_pool;
+    int nreactors;
+    bool pin_cpus;
+    size_t max_connections;
+    std::vector<int> listen_fds;
+    size_t batch_size;
+    size_t max_body_size;
+    size_t body_buffer_size;
+    IoBackend::Type io_backend;
 
     UrlMap url_map;
+    FileCache file_cache;
+    ResponseCache response_cache;
 
-    static const int EPOLL_FLAGS = 0;
-
-    int open_listenfd();
-    int make_socket_non_blocking(int sfd);
-    int epoll_add(int epfd, int fd, struct epoll_event* event);
+    static CallBatch& current_batch();
+    void run_calls(CallBatch& calls);
+    void start_async_call(HandlerCall& call);
+    void cache_response(const UrlMap::Route* route, ByteBuffer* cache_key, uint64_t cache_hash, HttpResponse& response);
 };
 
 #endif
@@ -0,0 +1,20 @@
+#ifndef _PORGI_HTTP_STATUS_H_
+#define _PORGI_HTTP_STATUS_H_
+
+#include "byte_buffer.h"
+
+#include <cstddef>
+#include <memory>
+
+/* the reason phrase of a status code, empty if it has none registered */
+const char* http_reason_phrase(int status_code);
+
+/* Append "HTTP/1.1 <code> <reason>" and the Server header. The lines of codes between 100 and 599 are
+ * formatted once and copied from a table. */
+void append_status_line(int status_code, ByteBuffer& buf);
+
+/* The "Date: ...\r\n" header for the current second. It is formatted at most once per second in each
+ * thread and shared by every response sent in that second. */
+const std::shared_ptr<const ByteBuffer>& current_date_header();
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _PORGI_HTTP_TOKENIZER_H_
+#define _PORGI_HTTP_TOKENIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/* Character classes of the HTTP grammar and vectorized scanners over them. Each scan_* function
+ * returns the first byte in [p, end) that does not belong to its class (or end), so HttpParser can
+ * skip over runs of ordinary bytes and only run its state machine on delimiters and invalid input.
+ * The SIMD implementation is selected once at startup based on the CPU, with a scalar fallback. */
+class HttpTokenizer {
+public:
+    static bool is_path_char(uint8_t ch) { return path_chars[ch]; }
+    static bool is_query_char(uint8_t ch) { return query_chars[ch]; }
+    static bool is_token_char(uint8_t ch) { return token_chars[ch]; }
+    static bool is_value_char(uint8_t ch) { return value_chars[ch]; }
+
+    /* URI path without the query string */
+    static const uint8_t* scan_path(const uint8_t* p, const uint8_t* end) { return impl.scan_path(p, end); }
+    static const uint8_t* scan_query(const uint8_t* p, const uint8_t* end) { return impl.scan_query(p, end); }
+    /* header field name */
+    static const uint8_t* scan_token(const uint8_t* p, const uint8_t* end) { return impl.scan_token(p, end); }
+    /* header field value including inner whitespace */
+    static const uint8_t* scan_value(const uint8_t* p, const uint8_t* end) { return impl.scan_value(p, end); }
+
+    static const char* implementation_name() { return impl.name; }
+
+private:
+    using ScanFunc = const uint8_t* (*)(const uint8_t* p, const uint8_t* end);
+
+    struct Implementation {
+        const char* name;
+        ScanFunc scan_path;
+        ScanFunc scan_query;
+        ScanFunc scan_token;
+        ScanFunc scan_value;
+    };
+
+    static const bool path_chars[256];
+    static const bool query_chars[256];
+    static const bool token_chars[256];
+    static const bool value_chars[256];
+
+    static const Implementation impl;
+
+    static Implementation select_implementation();
+};
+
+#endif
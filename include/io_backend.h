@@ -0,0 +1,69 @@
+#ifndef _PORGI_IO_BACKEND_H_
+#define _PORGI_IO_BACKEND_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+class CompletionQueue;
+class HttpConnection;
+class OutputQueue;
+class Reactor;
+
+/* What a backend keeps track of for each connection. */
+struct IoState {
+    IoState() : receiving(false), writing(false), closing(false), close_linked(false), write_size(0) { }
+
+    /* a receive is armed, or still winding down after a cancel */
+    bool receiving;
+
+    /* a write, or a wait for the socket to take more, is in flight */
+    bool writing;
+    /* a request to close the socket has been submitted */
+    bool closing;
+    /* the close only goes ahead if the write in flight completes */
+    bool close_linked;
+    /* the bytes of the write in flight */
+    size_t write_size;
+};
+
+/* How a reactor waits for events and moves bytes through its sockets. The epoll backend is told when
+ * a socket is ready and makes a system call for each operation; the io_uring backend submits the
+ * operations to a ring in batches and is told when they have completed. All methods are called on
+ * the reactor thread. */
+class IoBackend {
+public:
+    enum class Type {
+        EPOLL,
+        URING,
+    };
+
+    virtual ~IoBackend() { }
+
+    /* false if name is not a backend */
+    static bool parse_type(const std::string& name, Type& type);
+    /* A backend of the given type for reactor, accepting from listen_fd and woken up by completions.
+     * Falls back to epoll if io_uring is not available. */
+    static std::unique_ptr<IoBackend> create(Type type, Reactor* reactor, int listen_fd, bool shared_listen_fd,
+                                             CompletionQueue* completions);
+
+    /* called once on the reactor thread before the first poll */
+    virtual void start() = 0;
+    /* wait for the next round of events and handle them */
+    virtual void poll() = 0;
+
+    /* start receiving on an accepted connection */
+    virtual void add_connection(HttpConnection* conn) = 0;
+    /* Write as much of out as the socket takes. Returns the number of bytes written right away, which
+     * are consumed from out, or -1 on error. Whatever is written asynchronously instead is reported to
+     * conn->handle_written(). last tells that the connection is to be closed once out is written. */
+    virtual ssize_t write(HttpConnection* conn, OutputQueue& out, bool last) = 0;
+    /* stop handing input to conn while its output is backed up, and start again once it has drained */
+    virtual void pause_input(HttpConnection* conn) = 0;
+    virtual void resume_input(HttpConnection* conn) = 0;
+    /* close the socket of conn, nothing is received on it anymore */
+    virtual void close(HttpConnection* conn) = 0;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _PORGI_OUTPUT_QUEUE_H_
+#define _PORGI_OUTPUT_QUEUE_H_
+
+#include "byte_buffer.h"
+#include "file_cache.h"
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Bytes waiting to be written to a socket, kept as a list of segments so that response heads, bodies
+ * and fragments shared between responses go out with one writev without being copied together.
+ * File regions are sent with sendfile. A partial write is resumed at the exact byte it stopped at. */
+class OutputQueue {
+public:
+    /* upper bound on the segments passed to a single writev */
+    static const size_t MAX_IOVECS = 64;
+
+    OutputQueue() : nbytes(0), nfiles(0) { }
+
+    bool empty() const { return segments.empty(); }
+    size_t size() const { return nbytes; }
+    size_t num_segments() const { return segments.size(); }
+    size_t num_files() const { return nfiles; }
+
+    void append(ByteBuffer&& buf);
+    void append(std::shared_ptr<const ByteBuffer> buf);
+    /* data is not copied, it stays valid for as long as owner is held */
+    void append_shared(std::shared_ptr<const void> owner, const void* data, size_t size);
+    /* data is not copied and must stay valid for the life of the program */
+    void append_static(const void* data, size_t size);
+    void append_file(std::shared_ptr<const OpenFile> file, size_t offset, size_t length);
+    /* move every segment of other to the end of this queue */
+    void splice(OutputQueue& other);
+
+    /* write as much as the socket takes, returns the number of bytes written or -1 on error */
+    ssize_t flush(int fd);
+    void clear();
+
+    /* For writes that complete asynchronously: the buffers up to the next file region, at most MAX_IOVECS
+     * of them, are described in iov and their total size in nbytes. Returns the number of iovecs, 0 if
+     * the queue starts with a file region. Nothing is consumed. */
+    int gather(struct iovec* iov, size_t& nbytes) const;
+    bool front_is_file() const { return !segments.empty() && segments.front().type == SegmentType::FILE; }
+    /* sendfile the file region at the front, returns what sendfile returned */
+    ssize_t send_file(int fd);
+    /* drop count bytes written from the front */
+    void consume(size_t count);
+
+private:
+    enum class SegmentType {
+        OWNED,
+        SHARED,
+        STATIC,
+        FILE,
+    };
+
+    struct Segment {
+        SegmentType type;
+        ByteBuffer owned;
+        std::shared_ptr<const void> shared;
+        /* the memory of a shared or static segment */
+        const uint8_t* static_data;
+        std::shared_ptr<const OpenFile> file;
+        /* where the region starts in the file */
+        size_t file_offset;
+        size_t offset;
+        size_t size;
+
+        /* the unwritten part */
+        const uint8_t* data() const;
+        size_t remaining() const { return size - offset; }
+    };
+
+    std::deque<Segment> segments;
+    size_t nbytes;
+    size_t nfiles;
+
+    ssize_t write_buffers(int fd);
+};
+
+#endif
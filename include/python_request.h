@@ -0,0 +1,25 @@
+#ifndef _PORGI_PYTHON_REQUEST_H_
+#define _PORGI_PYTHON_REQUEST_H_
+
+#include "http_request.h"
+
+#include <Python.h>
+
+/* The request object handed to Python handlers, a CPython type written by hand. It refers to the
+ * HttpRequest instead of copying it and only builds the Python objects for the fields a handler reads:
+ * uri, query_string and header values become str on first access, method and well-known header names
+ * are interned once, and raw_uri, raw_query_string and headers.raw() are bytes copied from the request.
+ * request.body is a file-like reader of the request body with read() and readinto(). All of these require
+ * the GIL. */
+
+/* creates the types and the interned strings, returns false with a Python error set on failure */
+bool init_python_request_types();
+PyTypeObject* get_python_request_type();
+
+/* a new reference */
+PyObject* make_python_request(const HttpRequest& request);
+/* Detach the object from the request once it has been answered and the request's storage may be reused.
+ * Later attribute access raises. */
+void invalidate_python_request(PyObject* obj);
+
+#endif
@@ -11,15 +11,27 @@ public:
     explicit PythonScriptInterface(const std::string& path);
 
     void load_script(HttpServer* server) override;
+    void run_batch(const std::function<void()>& batch) override;
 
 private:
     HttpServer* server;
     boost::python::object globals;
+    /* the interpreter the script runs in, entered by the workers once the script has been loaded */
+    PyInterpreterState* interpreter;
+    /* async handlers run as coroutines on an asyncio loop with a thread of its own */
+    bool has_async_routes;
+    boost::python::object event_loop;
+    boost::python::object run_coroutine_threadsafe;
 
     void inject_namespace(boost::python::object& _namespace);
 
-    void _py_register_route(const ByteBuffer& rule, const boost::python::object& f, const boost::python::list& methods);
+    void _py_register_route(const ByteBuffer& rule, const boost::python::object& f, const boost::python::list& methods,
+                            double cache_ttl, const boost::python::list& vary);
+    void _py_register_static(const ByteBuffer& prefix, const std::string& directory);
+    boost::python::dict _py_cache_stats() const;
     UrlMap::RequestHandler handler_wrapper(const boost::python::object& f);
+    UrlMap::AsyncRequestHandler async_handler_wrapper(const boost::python::object& f);
+    void start_event_loop();
 
     std::string get_error_string() const;
 };
@@ -0,0 +1,50 @@
+#ifndef _PORGI_REACTOR_H_
+#define _PORGI_REACTOR_H_
+
+#include "completion_queue.h"
+#include "connection_pool.h"
+#include "io_backend.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class HttpServer;
+
+/* An independent event loop with its own listening socket, I/O backend and pool of at most
+ * max_connections connections. Multiple reactors share the listening port through SO_REUSEPORT.
+ * Reactors of different worker processes are given the same inherited socket instead. Work that
+ * other threads finish for its connections comes back through its completion queue. */
+class Reactor {
+public:
+    /* the reactor opens a listening socket of its own unless it is given one shared with other processes */
+    Reactor(HttpServer* server, int index, size_t max_connections, int cpu = -1, int shared_listen_fd = -1);
+    ~Reactor();
+
+    int get_index() const { return index; }
+
+    void run();
+
+    /* take over a connection accepted by the backend, it is turned away if the pool is full */
+    void accept_connection(int conn_fd);
+
+    /* a listening socket bound with SO_REUSEPORT, returns -1 on error */
+    static int open_listenfd(const std::string& host, uint16_t port, int backlog);
+
+private:
+    HttpServer* server;
+    int index;
+    int cpu;
+    int listen_fd;
+    CompletionQueue completions;
+    ConnectionPool pool;
+    std::unique_ptr<IoBackend> backend;
+
+    void reject_connection(int conn_fd);
+    void pin_to_cpu();
+
+    int make_socket_non_blocking(int sfd);
+};
+
+#endif
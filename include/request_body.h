@@ -0,0 +1,50 @@
+#ifndef _PORGI_REQUEST_BODY_H_
+#define _PORGI_REQUEST_BODY_H_
+
+#include "byte_buffer.h"
+#include "exceptions.h"
+
+#include <cstddef>
+
+/* The body of a request, received in full before its handler runs. The first memory_limit bytes are
+ * kept in memory and the rest is spilled to an unlinked temporary file, so a large upload is never
+ * held in memory as a whole. The spilled bytes are buffered by append() and written out in batches by
+ * write_spill(), which runs on a worker so that a slow disk does not hold up the event loop. The body
+ * is only read once every batch has been written. Failures to write or read the file throw FileIOError. */
+class RequestBody {
+public:
+    static const size_t DEFAULT_MEMORY_LIMIT = 65536;
+
+    RequestBody() : fd(-1), memory_limit(DEFAULT_MEMORY_LIMIT), length(0) { }
+    ~RequestBody();
+
+    RequestBody(const RequestBody&) = delete;
+    RequestBody& operator=(const RequestBody&) = delete;
+
+    void set_memory_limit(size_t limit) { memory_limit = limit; }
+
+    size_t size() const { return length; }
+    /* whether part of the body is in the temporary file */
+    bool spilled() const { return fd != -1; }
+
+    void append(const void* data, size_t len);
+    /* the spilled bytes not handed to write_spill() yet */
+    size_t unwritten() const { return spill.size(); }
+    /* Take the spilled bytes buffered so far. The batches have to be written in the order they were
+     * taken, one at a time, but on any thread. */
+    ByteBuffer take_spill();
+    void write_spill(const ByteBuffer& batch);
+    /* copy up to len bytes starting at offset into buf, returns the number of bytes copied */
+    size_t read(size_t offset, void* buf, size_t len) const;
+
+private:
+    ByteBuffer memory;
+    ByteBuffer spill;
+    int fd;
+    size_t memory_limit;
+    size_t length;
+
+    void open_spill_file();
+};
+
+#endif
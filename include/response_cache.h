@@ -0,0 +1,87 @@
+#ifndef _PORGI_RESPONSE_CACHE_H_
+#define _PORGI_RESPONSE_CACHE_H_
+
+#include "byte_buffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/* A response in wire format. It is split around the Connection header, which depends on the request
+ * it answers, so that the same bytes can be sent on any connection without being copied. */
+struct SerializedResponse {
+    int status_code;
+    /* status line and the headers before Connection */
+    ByteBuffer head;
+    /* the remaining headers, the blank line and the body */
+    ByteBuffer tail;
+    /* the body at the end of tail, left out for HEAD requests */
+    size_t body_size;
+};
+
+/* Serialized responses of cacheable routes, keyed by the request line and the headers the route
+ * varies on. The map is split into lock-striped shards which evict least recently used entries to
+ * stay within their share of the memory limit. */
+class ResponseCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static const size_t NSHARDS = 16;
+    static const size_t DEFAULT_CAPACITY = 64 << 20;
+
+    explicit ResponseCache(size_t capacity = DEFAULT_CAPACITY) : capacity(capacity) { }
+
+    /* bytes of responses and keys kept at most */
+    void set_capacity(size_t capacity) { this->capacity = capacity; }
+    size_t get_capacity() const { return capacity; }
+
+    /* returns nullptr on a miss or if the entry has expired */
+    std::shared_ptr<const SerializedResponse> get(const ByteBuffer& key, uint64_t hash);
+    void put(const ByteBuffer& key, uint64_t hash, std::shared_ptr<const SerializedResponse> response,
+             Clock::duration ttl);
+
+    uint64_t get_hits() const;
+    uint64_t get_misses() const;
+    size_t get_size() const;
+    size_t get_bytes() const;
+
+private:
+    struct IdentityHash {
+        size_t operator()(uint64_t hash) const { return (size_t) hash; }
+    };
+
+    struct Entry {
+        uint64_t hash;
+        ByteBuffer key;
+        std::shared_ptr<const SerializedResponse> response;
+        Clock::time_point expires;
+        size_t charge;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        /* most recently used first */
+        std::list<Entry> lru;
+        /* by hash, so that a lookup does not need to copy the key */
+        std::unordered_multimap<uint64_t, std::list<Entry>::iterator, IdentityHash> index;
+        size_t bytes = 0;
+
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    size_t capacity;
+    Shard shards[NSHARDS];
+
+    /* the low bits pick the bucket inside a shard, so the shard comes from the high ones */
+    Shard& get_shard(uint64_t hash) { return shards[hash >> 60]; }
+    static std::list<Entry>::iterator find(Shard& shard, const ByteBuffer& key, uint64_t hash);
+    static void erase(Shard& shard, std::list<Entry>::iterator it);
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _PORGI_RESPONSE_STREAM_H_
+#define _PORGI_RESPONSE_STREAM_H_
+
+#include "output_queue.h"
+
+#include <cstddef>
+
+/* A response body produced piece by piece, e.g. by a Python generator. The connection asks for more
+ * only while the client keeps up, so the body never has to be in memory as a whole. */
+class ResponseStream {
+public:
+    virtual ~ResponseStream() { }
+
+    /* Append the next pieces of the body to out, stopping once about max_bytes have been added. Returns
+     * false when the body is complete. Called on worker threads, never concurrently with itself. */
+    virtual bool produce(OutputQueue& out, size_t max_bytes) = 0;
+};
+
+#endif
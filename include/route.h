@@ -4,6 +4,9 @@
 #include "http_request.h"
 #include "exceptions.h"
 
+#include <chrono>
+#include <cstdint>
+#include <map>
 #include <unordered_map>
 #include <functional>
 #include <vector>
@@ -11,26 +14,166 @@
 class UrlMap {
 public:
     PORGI_DEF_ERROR(InvalidUrlRule);
-    PORGI_DEF_ERROR(UnmatchedUrl);
 
-    using UrlPatternMap = std::map<ByteBuffer, ByteBuffer>;
-    using RequestHandler = std::function<HttpResponse(const HttpRequest& request, const UrlPatternMap& pattern_map)>;
+    /* :name<int> is a decimal that fits in 64 bits, :name<uuid> is a UUID in its hyphenated form and a
+     * final :name<path> takes the rest of the URL, slashes included */
+    enum class ParamType : uint8_t {
+        STRING,
+        INT,
+        UUID,
+        PATH,
+    };
 
-    void register_rule(const ByteBuffer& rule, RequestHandler&& handler, const std::vector<HttpMethod>& methods);
-    RequestHandler match_url(const ByteBuffer& url, HttpMethod method, UrlPatternMap& pattern_map);
+    /* The values captured by the :name segments of the matched rule. They are kept as offsets into the
+     * URL, so filling them in allocates nothing, and they are only valid for as long as the URL is. */
+    class UrlParams {
+    public:
+        static const size_t MAX_PARAMS = 8;
 
-private:
+        struct Param {
+            const ByteBuffer* name;
+            ParamType type;
+            uint32_t offset;
+            uint32_t length;
+            /* the converted value of an INT parameter */
+            int64_t int_value;
+        };
+
+        UrlParams() : url(nullptr), count(0) { }
+
+        bool empty() const { return count == 0; }
+        size_t size() const { return count; }
+        const Param& operator[](size_t index) const { return params[index]; }
+        const Param* begin() const { return params; }
+        const Param* end() const { return params + count; }
+
+        const uint8_t* value(const Param& param) const { return url->data() + param.offset; }
+        /* returns nullptr if the rule has no parameter with this name */
+        const Param* find(const char* name, size_t len) const;
+
+    private:
+        friend class UrlMap;
+
+        const ByteBuffer* url;
+        size_t count;
+        Param params[MAX_PARAMS];
+    };
+
+    using RequestHandler = std::function<HttpResponse(const HttpRequest& request, const UrlParams& params)>;
+    using ResponseCallback = std::function<void(HttpResponse&&)>;
+    /* Starts handling the request and returns, the response is passed to callback once it is ready. The
+     * callback is only taken over if the handler returns normally. */
+    using AsyncRequestHandler = std::function<void(const HttpRequest& request, const UrlParams& params,
+                                                   ResponseCallback& callback)>;
+    /* path is the part of the URL below the mount point */
+    using MountHandler = std::function<HttpResponse(const HttpRequest& request, const uint8_t* path, size_t path_len)>;
+
+    /* Opt-in caching of a route's responses. Requests share a response if they have the same method,
+     * URI and query string and the same values for the headers in vary. */
+    struct CachePolicy {
+        CachePolicy() : ttl(std::chrono::steady_clock::duration::zero()) { }
+
+        std::chrono::steady_clock::duration ttl;
+        std::vector<ByteBuffer> vary;
+
+        bool enabled() const { return ttl > std::chrono::steady_clock::duration::zero(); }
+    };
+
+    /* exactly one of handler and async_handler is set */
+    struct Route {
+        RequestHandler handler;
+        AsyncRequestHandler async_handler;
+        CachePolicy cache;
+    };
+
+    UrlMap() : compiled(false) { }
 
+    void register_rule(const ByteBuffer& rule, const Route& route, const std::vector<HttpMethod>& methods);
+    /* Flatten the registered rules into the table match_url works on. No rule can be registered afterwards. */
+    void compile();
+    /* Returns nullptr if no rule matches. A static segment is preferred over a :name segment in the same
+     * position, typed parameters over untyped ones and those over a path, and the next candidate is
+     * tried if the rest of the URL does not match below it. HEAD requests fall back to the GET route.
+     * The route stays valid for as long as the map. */
+    const Route* match_url(const ByteBuffer& url, HttpMethod method, UrlParams& params) const;
+
+    /* A native handler for every URL below prefix, tried before the rules with the longest prefix
+     * first. Mount handlers run on the reactor thread and hold up its other connections while they run,
+     * so they must do no more than short system calls, such as the open and stat of StaticFiles. */
+    void register_mount(const ByteBuffer& prefix, MountHandler&& handler, const std::vector<HttpMethod>& methods);
+    /* returns nullptr if no mount matches, otherwise prefix_len is the length of the mount point; HEAD
+     * requests are taken by mounts for GET */
+    const MountHandler* match_mount(const ByteBuffer& url, HttpMethod method, size_t& prefix_len) const;
+
+private:
+    /* the trie rules are registered into, only used until compile() */
     struct UrlEntry {
-        std::unordered_map<HttpMethod, RequestHandler> handlers;
+        struct ParamChild {
+            ByteBuffer name;
+            ParamType type;
+            std::unique_ptr<UrlEntry> entry;
+        };
+
+        std::unordered_map<HttpMethod, Route> handlers;
+        /* ordered the same way as the compiled edges */
+        std::map<ByteBuffer, std::unique_ptr<UrlEntry> > children;
+        std::vector<ParamChild> params;
+    };
+
+    /* The compiled trie. Nodes refer to their edges and routes as ranges of the arrays below, and the
+     * static edges of a node are sorted by length and then bytes so that they can be binary searched. */
+    struct Node {
+        uint32_t first_child, nchildren;
+        uint32_t first_param, nparams;
+        uint32_t first_method, nmethods;
+    };
+
+    /* a static segment, stored in labels */
+    struct Edge {
+        uint32_t offset, length;
+        uint32_t node;
+    };
+
+    struct ParamEdge {
+        /* index in param_names */
+        uint32_t name;
+        ParamType type;
+        uint32_t node;
+    };
 
-        ByteBuffer pattern_name;
-        std::unique_ptr<UrlEntry> pattern_entry;
+    struct MethodRoute {
+        HttpMethod method;
+        uint32_t route;
+    };
 
-        std::unordered_map<ByteBuffer, std::unique_ptr<UrlEntry> > children;
+    struct Mount {
+        ByteBuffer prefix;
+        std::vector<HttpMethod> methods;
+        MountHandler handler;
     };
 
     UrlEntry root;
+    bool compiled;
+
+    std::vector<Node> nodes;
+    std::vector<Edge> child_edges;
+    std::vector<ParamEdge> param_edges;
+    std::vector<MethodRoute> method_routes;
+    std::vector<Route> routes;
+    ByteBuffer labels;
+    std::vector<ByteBuffer> param_names;
+
+    std::vector<Mount> mounts;
+
+    static bool parse_param(const uint8_t* segment, size_t len, ByteBuffer& name, ParamType& type);
+    /* whether value is a valid parameter of type, int_value is set for INT */
+    static bool convert_param(ParamType type, const uint8_t* value, size_t len, int64_t& int_value);
+
+    uint32_t compile_entry(UrlEntry& entry);
+    const Route* match_node(const Node& node, const ByteBuffer& url, size_t pos, HttpMethod method,
+                            UrlParams& params) const;
+    const Route* find_route(const Node& node, HttpMethod method) const;
+    const Node* find_child(const Node& node, const uint8_t* segment, size_t len) const;
 };
 
 #endif
@@ -3,6 +3,7 @@
 
 #include "exceptions.h"
 
+#include <functional>
 #include <string>
 
 class HttpServer;
@@ -14,6 +15,8 @@ public:
     explicit ScriptInterface(const std::string& path) : script_path(path) { }
 
     virtual void load_script(HttpServer* server) = 0;
+    /* Call several handlers in a row. An interpreter with a global lock takes it once around all of them. */
+    virtual void run_batch(const std::function<void()>& batch) { batch(); }
 
 protected:
     std::string script_path;
@@ -0,0 +1,37 @@
+#ifndef _PORGI_STATIC_FILES_H_
+#define _PORGI_STATIC_FILES_H_
+
+#include "file_cache.h"
+#include "http_request.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* Serves the files below a directory without going through the script. Bodies are sent with sendfile
+ * from files kept open in a FileCache, If-Modified-Since and single byte ranges are answered natively.
+ * A cache miss or revalidation opens or stats the file on the reactor thread. */
+class StaticFiles {
+public:
+    StaticFiles(const std::string& root, FileCache* cache);
+
+    /* path is what follows the mount point in the URL */
+    HttpResponse serve(const HttpRequest& request, const uint8_t* path, size_t path_len) const;
+
+private:
+    enum class RangeStatus {
+        NONE,
+        SATISFIABLE,
+        UNSATISFIABLE,
+    };
+
+    std::string root;
+    FileCache* cache;
+
+    /* percent-decode path and reject anything that could leave the root */
+    static bool resolve_path(const uint8_t* path, size_t path_len, std::string& rel_path);
+    static const char* content_type(const std::string& path);
+    static RangeStatus parse_range(const ByteBuffer& value, size_t size, size_t& first, size_t& last);
+};
+
+#endif
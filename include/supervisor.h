@@ -0,0 +1,46 @@
+#ifndef _PORGI_SUPERVISOR_H_
+#define _PORGI_SUPERVISOR_H_
+
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <signal.h>
+#include <sys/types.h>
+
+/* Runs a fixed number of worker processes and keeps them running. Each worker is forked from the
+ * supervisor and runs worker_main with its index. Workers that exit are started again, SIGHUP
+ * restarts all of them and SIGTERM or SIGINT stops them and then the supervisor. Everything the
+ * workers are meant to share, such as listening sockets, has to be opened before run(). */
+class Supervisor {
+public:
+    using WorkerMain = std::function<int(int index)>;
+
+    /* workers that exit sooner than this after being started are restarted only after this long */
+    static constexpr std::chrono::seconds RESTART_DELAY{1};
+
+    Supervisor(int nworkers, bool pin_cpus);
+
+    /* returns once every worker has been stopped */
+    int run(WorkerMain&& worker_main);
+
+private:
+    struct Worker {
+        pid_t pid;
+        std::chrono::steady_clock::time_point started;
+        /* when a worker that exited too early is to be started again */
+        std::chrono::steady_clock::time_point restart_at;
+    };
+
+    int nworkers;
+    bool pin_cpus;
+    std::vector<int> cpus;
+    std::vector<Worker> workers;
+    WorkerMain worker_main;
+    sigset_t old_mask;
+
+    void spawn(int index);
+    void reap(bool stopping);
+    void signal_workers(int signo);
+};
+
+#endif
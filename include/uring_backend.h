@@ -0,0 +1,118 @@
+#ifndef _PORGI_URING_BACKEND_H_
+#define _PORGI_URING_BACKEND_H_
+
+#include "exceptions.h"
+#include "io_backend.h"
+#include "output_queue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <sys/socket.h>
+
+/* <linux/io_uring.h> is left to the source file, it drags in macros like BLOCK_SIZE */
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/* An io_uring driven through the raw system calls. Connections are accepted by a multishot accept and
+ * read by a multishot receive per connection, which picks its buffers from a ring of provided buffers
+ * shared by all connections. Sends and closes are queued in the submission ring and submitted together
+ * with the wait for the next completions, and the last send to a connection that is going to be closed
+ * is linked to its close. */
+class UringBackend : public IoBackend {
+public:
+    PORGI_DEF_ERROR(Unavailable);
+
+    static const unsigned RING_ENTRIES = 1024;
+    /* the provided receive buffers, shared by every connection of the reactor */
+    static const unsigned RECV_BUFFER_COUNT = 256;
+    static const size_t RECV_BUFFER_SIZE = 16384;
+
+    /* throws Unavailable if the kernel lacks what is needed */
+    UringBackend(Reactor* reactor, int listen_fd, CompletionQueue* completions);
+    ~UringBackend();
+
+    UringBackend(const UringBackend&) = delete;
+    UringBackend& operator=(const UringBackend&) = delete;
+
+    void start() override;
+    void poll() override;
+
+    void add_connection(HttpConnection* conn) override;
+    ssize_t write(HttpConnection* conn, OutputQueue& out, bool last) override;
+    void pause_input(HttpConnection* conn) override;
+    void resume_input(HttpConnection* conn) override;
+    void close(HttpConnection* conn) override;
+
+private:
+    /* what a completion is for, kept in the low bits of its user_data below the connection */
+    enum Op : uint64_t {
+        ACCEPT = 1,
+        WAKEUP,
+        RECV,
+        SEND,
+        POLL_OUT,
+        CLOSE,
+        CANCEL,
+    };
+    static const uint64_t OP_MASK = 7;
+    static const uint16_t BUFFER_GROUP = 0;
+
+    /* the kernel copies a message when the send is submitted, it only has to live until then */
+    struct SendMessage {
+        struct msghdr msg;
+        struct iovec iov[OutputQueue::MAX_IOVECS];
+    };
+
+    Reactor* reactor;
+    int listen_fd;
+    CompletionQueue* completions;
+    int ring_fd;
+
+    /* the rings shared with the kernel */
+    void* ring_mem;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_khead;
+    unsigned* sq_ktail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* cq_khead;
+    unsigned* cq_ktail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    /* entries queued, not yet made visible to the kernel */
+    unsigned sq_tail;
+
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    uint8_t* recv_buffers;
+    uint16_t buf_tail;
+
+    std::deque<SendMessage> send_messages;
+
+    /* make sure the next count entries can be queued, submitting what is queued if need be */
+    void reserve(unsigned count);
+    struct io_uring_sqe* get_sqe();
+    /* submit what is queued and wait for at least wait_nr completions */
+    void submit(unsigned wait_nr);
+    void handle_completion(uint64_t user_data, int32_t res, uint32_t flags);
+
+    void arm_accept();
+    void arm_wakeup();
+    void arm_recv(HttpConnection* conn);
+    void handle_recv(HttpConnection* conn, int32_t res, uint32_t flags);
+    void handle_send(HttpConnection* conn, int32_t res);
+    void wait_writable(HttpConnection* conn);
+    /* cancel everything on the socket, then close it */
+    void queue_close(HttpConnection* conn);
+    void recycle_buffer(uint16_t bid);
+    /* unmap and close whatever has been set up */
+    void teardown();
+
+    static uint64_t make_user_data(HttpConnection* conn, Op op) { return reinterpret_cast<uint64_t>(conn) | op; }
+};
+
+#endif
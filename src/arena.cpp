@@ -0,0 +1,108 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+static inline uint8_t* align_up(uint8_t* p, size_t align)
+{
+    return reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(p) + align - 1) & ~(uintptr_t) (align - 1));
+}
+
+const size_t Arena::HEADER_SIZE = (sizeof(Block) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+Arena::Arena(size_t block_size)
+    : block_size(block_size), blocks(nullptr), cursor(nullptr), limit(nullptr), destructors(nullptr)
+{
+}
+
+Arena::~Arena()
+{
+    reset();
+    free_blocks(blocks);
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+    auto p = align_up(cursor, align);
+    if (cursor && p + size <= limit) {
+        cursor = p + size;
+        return p;
+    }
+
+    return allocate_slow(size, align);
+}
+
+void* Arena::allocate_slow(size_t size, size_t align)
+{
+    size_t new_size = std::max(block_size, HEADER_SIZE + size + align);
+
+    auto block = static_cast<Block*>(std::malloc(new_size));
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    block->size = new_size;
+
+    auto p = align_up(reinterpret_cast<uint8_t*>(block) + HEADER_SIZE, align);
+
+    if (new_size > block_size && cursor) {
+        /* oversized requests get a block of their own behind the current one, so that we can
+         * keep bumping in what is left of the current block */
+        block->next = blocks->next;
+        blocks->next = block;
+        return p;
+    }
+
+    block->next = blocks;
+    blocks = block;
+    cursor = p + size;
+    limit = reinterpret_cast<uint8_t*>(block) + new_size;
+
+    return p;
+}
+
+void Arena::add_destructor(void* object, void (*destroy)(void*))
+{
+    auto d = static_cast<Destructor*>(allocate(sizeof(Destructor), alignof(Destructor)));
+    d->next = destructors;
+    d->destroy = destroy;
+    d->object = object;
+    destructors = d;
+}
+
+void Arena::reset()
+{
+    /* destroy in reverse order of creation */
+    while (destructors) {
+        auto d = destructors;
+        destructors = d->next;
+        d->destroy(d->object);
+    }
+
+    /* keep the oldest block if it is a regular one, which is the last one in the list */
+    Block* keep = blocks;
+    Block** prev = &blocks;
+    while (keep && keep->next) {
+        prev = &keep->next;
+        keep = keep->next;
+    }
+    if (keep && keep->size != block_size) {
+        keep = nullptr;
+    } else {
+        *prev = nullptr;
+    }
+
+    free_blocks(blocks);
+
+    blocks = keep;
+    cursor = keep ? reinterpret_cast<uint8_t*>(keep) + HEADER_SIZE : nullptr;
+    limit = keep ? reinterpret_cast<uint8_t*>(keep) + keep->size : nullptr;
+}
+
+void Arena::free_blocks(Block* block)
+{
+    while (block) {
+        auto next = block->next;
+        std::free(block);
+        block = next;
+    }
+}
@@ -0,0 +1,177 @@
+#include "body_parser.h"
+
+#include <algorithm>
+
+static int hex_value(uint8_t ch)
+{
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+void BodyParser::start_length(uint64_t length)
+{
+    state = State::LENGTH;
+    remaining = length;
+    received = 0;
+}
+
+void BodyParser::start_chunked(uint64_t max_size)
+{
+    state = State::CHUNK_SIZE_START;
+    remaining = 0;
+    this->max_size = max_size;
+    received = 0;
+    skipped = 0;
+}
+
+BodyParser::ParseStatus BodyParser::parse_body(const ByteBuffer& req_buf, size_t& offset, RequestBody& body)
+{
+    auto end = std::end(req_buf);
+
+    for (auto p = std::begin(req_buf) + offset; p != end; ++p) {
+        /* the data itself is moved over in one piece, the state machine only sees the framing */
+        if (state == State::LENGTH || state == State::CHUNK_DATA) {
+            size_t n = (size_t) std::min<uint64_t>(remaining, (uint64_t) (end - p));
+            body.append(p, n);
+            p += n;
+            remaining -= n;
+            received += n;
+
+            if (remaining > 0) break;
+            if (state == State::LENGTH) {
+                offset = p - std::begin(req_buf);
+                return ParseStatus::COMPLETE;
+            }
+
+            state = State::CHUNK_DATA_END;
+            if (p == end) break;
+        }
+
+        auto ch = *p;
+
+        switch (state) {
+        case State::CHUNK_SIZE_START:
+        case State::CHUNK_SIZE:
+            {
+                int digit = hex_value(ch);
+                if (digit >= 0) {
+                    /* past the limit already, however many more digits there are */
+                    if (remaining > max_size) {
+                        throw BodyTooLarge("request body too large");
+                    }
+                    remaining = remaining * 16 + (uint64_t) digit;
+                    state = State::CHUNK_SIZE;
+                    break;
+                }
+                if (state == State::CHUNK_SIZE_START) {
+                    throw InvalidChunk("invalid chunk size");
+                }
+
+                switch (ch) {
+                case ';':
+                case ' ':
+                case '\t':
+                    skipped = 0;
+                    state = State::CHUNK_EXTENSION;
+                    break;
+                case '\r':
+                    state = State::CHUNK_SIZE_ALMOST_DONE;
+                    break;
+                case '\n':
+                    end_chunk_size();
+                    break;
+                default:
+                    throw InvalidChunk("invalid chunk size");
+                }
+                break;
+            }
+
+        case State::CHUNK_EXTENSION:
+            /* extensions are not understood by anyone here and ignored */
+            if (ch == '\r') {
+                state = State::CHUNK_SIZE_ALMOST_DONE;
+            } else if (ch == '\n') {
+                end_chunk_size();
+            } else if (++skipped > MAX_SKIPPED_SIZE) {
+                throw InvalidChunk("chunk extension too long");
+            }
+            break;
+
+        case State::CHUNK_SIZE_ALMOST_DONE:
+            if (ch != '\n') {
+                throw InvalidChunk("LF character expected");
+            }
+            end_chunk_size();
+            break;
+
+        case State::CHUNK_DATA_END:
+            if (ch == '\r') {
+                state = State::CHUNK_DATA_ALMOST_DONE;
+            } else if (ch == '\n') {
+                state = State::CHUNK_SIZE_START;
+            } else {
+                throw InvalidChunk("CRLF expected after chunk data");
+            }
+            break;
+
+        case State::CHUNK_DATA_ALMOST_DONE:
+            if (ch != '\n') {
+                throw InvalidChunk("LF character expected");
+            }
+            state = State::CHUNK_SIZE_START;
+            break;
+
+        case State::TRAILER_START:
+            if (ch == '\r') {
+                state = State::TRAILER_ALMOST_DONE;
+                break;
+            }
+            if (ch == '\n') {
+                offset = p - std::begin(req_buf) + 1;
+                return ParseStatus::COMPLETE;
+            }
+            state = State::TRAILER;
+            /* fall through */
+
+        case State::TRAILER:
+            /* trailer fields are skipped, handlers only see the headers */
+            if (++skipped > MAX_SKIPPED_SIZE) {
+                throw InvalidChunk("trailer section too long");
+            }
+            if (ch == '\n') {
+                state = State::TRAILER_START;
+            }
+            break;
+
+        case State::TRAILER_ALMOST_DONE:
+            if (ch != '\n') {
+                throw InvalidChunk("LF character expected");
+            }
+            offset = p - std::begin(req_buf) + 1;
+            return ParseStatus::COMPLETE;
+
+        default:
+            break;
+        }
+    }
+
+    offset = req_buf.size();
+    return ParseStatus::NEED_MORE;
+}
+
+void BodyParser::end_chunk_size()
+{
+    if (remaining == 0) {
+        /* the last chunk, the trailer section follows */
+        skipped = 0;
+        state = State::TRAILER_START;
+        return;
+    }
+
+    if (remaining > max_size - received) {
+        throw BodyTooLarge("request body too large");
+    }
+    state = State::CHUNK_DATA;
+}
@@ -1,42 +1,93 @@
 #include "byte_buffer.h"
+#include "arena.h"
 
 #include <algorithm>
 #include <cstring>
 
-ByteBuffer::ByteBuffer(size_t capacity) : _capacity(capacity), _size(0)
+ByteBuffer::ByteBuffer(size_t capacity) : _capacity(0), _size(0), _data(_inline), _arena(nullptr)
 {
     allocate(capacity);
 }
 
-ByteBuffer::ByteBuffer(size_t size, uint8_t fill) : _capacity(size), _size(size)
+ByteBuffer::ByteBuffer(size_t size, uint8_t fill) : _capacity(0), _size(size), _data(_inline), _arena(nullptr)
 {
-    allocate(_capacity);
-    std::memset(_data.get(), fill, size);
+    allocate(size);
+    std::memset(_data, fill, size);
 }
 
-ByteBuffer::ByteBuffer(const void* buf, size_t size, size_t capacity) : _capacity(capacity), _size(size)
+ByteBuffer::ByteBuffer(const void* buf, size_t size, size_t capacity) : _capacity(0), _size(size), _data(_inline), _arena(nullptr)
 {
     if (size > capacity) {
         throw std::runtime_error("size cannot be greater than capacity");
     }
 
     allocate(capacity);
-    std::memcpy(_data.get(), buf, size);
+    if (size != 0) {
+        std::memcpy(_data, buf, size);
+    }
+}
+
+ByteBuffer::ByteBuffer(Arena* arena) : _capacity(INLINE_CAPACITY), _size(0), _data(_inline), _arena(arena) { }
+
+ByteBuffer::ByteBuffer(const void* buf, size_t size, Arena* arena)
+    : _capacity(0), _size(size), _data(_inline), _arena(arena)
+{
+    allocate(size);
+    if (size != 0) {
+        std::memcpy(_data, buf, size);
+    }
+}
+
+ByteBuffer::ByteBuffer(ByteBuffer&& other) noexcept
+    : _capacity(INLINE_CAPACITY), _size(0), _data(_inline), _arena(other._arena)
+{
+    *this = std::move(other);
+}
+
+ByteBuffer::~ByteBuffer()
+{
+    release();
 }
 
 ByteBuffer& ByteBuffer::operator=(const ByteBuffer& rhs)
 {
-    _size = rhs._size;
-    _capacity = rhs._capacity;
+    if (this == &rhs) return *this;
 
-    allocate(_capacity);
-    std::memcpy(_data.get(), rhs._data.get(), _size);
+    /* reuse the storage we already have if it is large enough */
+    if (rhs._size > _capacity) {
+        release();
+        allocate(rhs._size);
+    }
+
+    _size = rhs._size;
+    if (_size != 0) {
+        std::memcpy(_data, rhs._data, _size);
+    }
     return *this;
 }
 
 ByteBuffer& ByteBuffer::operator=(ByteBuffer&& rhs) noexcept
 {
-    swap(rhs);
+    if (this == &rhs) return *this;
+
+    if (rhs.is_inline()) {
+        /* inline contents always fit in our storage */
+        std::memcpy(_data, rhs._data, rhs._size);
+        _size = rhs._size;
+    } else if (rhs._arena != _arena) {
+        /* storage can only be taken over within the same arena, otherwise it could outlive it */
+        *this = static_cast<const ByteBuffer&>(rhs);
+    } else {
+        release();
+        _data = rhs._data;
+        _capacity = rhs._capacity;
+        _size = rhs._size;
+
+        rhs._data = rhs._inline;
+        rhs._capacity = INLINE_CAPACITY;
+    }
+
+    rhs._size = 0;
     return *this;
 }
 
@@ -66,16 +117,78 @@ void ByteBuffer::append(const void* buf, size_t append_size)
     _size = new_size;
 }
 
-void ByteBuffer::clear()
+void ByteBuffer::append_decimal(uint64_t value)
+{
+    size_t ndigits = 1;
+    for (uint64_t v = value; v >= 10; v /= 10) {
+        ndigits++;
+    }
+
+    size_t new_size = _size + ndigits;
+    if (new_size > _capacity) {
+        extend(new_size);
+    }
+
+    auto p = _data + new_size;
+    do {
+        *--p = (uint8_t) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    _size = new_size;
+}
+
+void ByteBuffer::consume(size_t count)
+{
+    if (count >= _size) {
+        _size = 0;
+        return;
+    }
+
+    std::memmove(_data, _data + count, _size - count);
+    _size -= count;
+}
+
+void ByteBuffer::shrink()
 {
-    _data.reset(nullptr);
-    _size = 0;
-    _capacity = 0;
+    /* nothing would be given back to an arena */
+    if (is_inline() || _arena || _size == _capacity) return;
+
+    auto old_data = _data;
+    allocate(_size);
+    if (_size != 0) {
+        std::memcpy(_data, old_data, _size);
+    }
+    delete[] old_data;
 }
 
 void ByteBuffer::allocate(size_t capacity)
 {
-    _data.reset(new uint8_t[capacity]);
+    if (capacity <= INLINE_CAPACITY) {
+        _data = _inline;
+        _capacity = INLINE_CAPACITY;
+    } else {
+        _data = allocate_storage(capacity);
+        _capacity = capacity;
+    }
+}
+
+uint8_t* ByteBuffer::allocate_storage(size_t capacity)
+{
+    if (_arena) {
+        return static_cast<uint8_t*>(_arena->allocate(capacity, 1));
+    }
+    return new uint8_t[capacity];
+}
+
+void ByteBuffer::release()
+{
+    if (!is_inline() && !_arena) {
+        delete[] _data;
+    }
+
+    _data = _inline;
+    _capacity = INLINE_CAPACITY;
 }
 
 void ByteBuffer::extend(size_t new_capacity)
@@ -83,19 +196,91 @@ void ByteBuffer::extend(size_t new_capacity)
     if (new_capacity > _capacity && new_capacity < 2 * _capacity)
         new_capacity = 2 * _capacity;
 
-    auto new_buf = new uint8_t[new_capacity];
+    auto new_buf = allocate_storage(new_capacity);
 
     if (_size != 0) {
-        std::memcpy(new_buf, _data.get(), _size);
+        std::memcpy(new_buf, _data, _size);
     }
-    _data.reset(new_buf);
+    if (!is_inline() && !_arena) {
+        delete[] _data;
+    }
+    _data = new_buf;
 
     _capacity = new_capacity;
 }
 
-void ByteBuffer::swap(ByteBuffer &rhs)
+static inline uint64_t wymix(uint64_t a, uint64_t b)
 {
-    std::swap(_capacity, rhs._capacity);
-    std::swap(_size, rhs._size);
-    _data.swap(rhs._data);
+    __uint128_t r = (__uint128_t) a * b;
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t wyr8(const uint8_t* p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wyr4(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t wyr3(const uint8_t* p, size_t k)
+{
+    return (((uint64_t) p[0]) << 16) | (((uint64_t) p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed)
+{
+    static const uint64_t secret[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                                        0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+    auto p = static_cast<const uint8_t*>(data);
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ secret[0], secret[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    __uint128_t r = (__uint128_t) a * b;
+    a = (uint64_t) r;
+    b = (uint64_t) (r >> 64);
+
+    return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
 }
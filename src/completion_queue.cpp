@@ -0,0 +1,82 @@
+#include "completion_queue.h"
+#include "easylogging++.h"
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstdint>
+#include <stdexcept>
+
+CompletionQueue::CompletionQueue() : head(nullptr)
+{
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) {
+        throw std::runtime_error("failed to create eventfd");
+    }
+}
+
+CompletionQueue::~CompletionQueue()
+{
+    /* whatever is left belongs to connections that are being torn down along with the reactor */
+    auto completion = head.exchange(nullptr, std::memory_order_acquire);
+    while (completion) {
+        auto next = completion->next;
+        delete completion;
+        completion = next;
+    }
+
+    ::close(event_fd);
+}
+
+void CompletionQueue::post(Completion* completion)
+{
+    completion->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(completion->next, completion, std::memory_order_release,
+                                       std::memory_order_relaxed))
+        ;
+
+    /* a non-empty queue has a wakeup on the way already */
+    if (completion->next) return;
+
+    uint64_t one = 1;
+    while (write(event_fd, &one, sizeof(one)) < 0) {
+        /* EAGAIN means the counter is saturated, the reactor is going to wake up anyway */
+        if (errno != EINTR) {
+            if (errno != EAGAIN) {
+                LOG(ERROR) << "eventfd write error(" << errno << ")";
+            }
+            break;
+        }
+    }
+}
+
+size_t CompletionQueue::drain()
+{
+    /* reset the eventfd before taking the list, a post that lands in between wakes the reactor once more */
+    uint64_t count;
+    while (read(event_fd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+
+    /* taking the whole list at once leaves no room for ABA on the posting side */
+    auto completion = head.exchange(nullptr, std::memory_order_acquire);
+
+    /* the list is newest first */
+    Completion* ordered = nullptr;
+    while (completion) {
+        auto next = completion->next;
+        completion->next = ordered;
+        ordered = completion;
+        completion = next;
+    }
+
+    size_t ncompleted = 0;
+    while (ordered) {
+        auto next = ordered->next;
+        ordered->complete();
+        delete ordered;
+        ordered = next;
+        ncompleted++;
+    }
+
+    return ncompleted;
+}
@@ -0,0 +1,77 @@
+#include "connection_pool.h"
+
+#include <cstdlib>
+#include <new>
+
+ConnectionPool::ConnectionPool(size_t capacity)
+    : capacity(capacity), nused(0), slots(nullptr), free_list(nullptr), recycled(nullptr)
+{
+    void* mem;
+    if (posix_memalign(&mem, CACHE_LINE_SIZE, capacity * sizeof(Slot)) != 0) {
+        throw std::bad_alloc();
+    }
+    slots = static_cast<Slot*>(mem);
+
+    /* hand out the slots from the start of the slab first */
+    for (size_t i = capacity; i > 0; --i) {
+        auto slot = &slots[i - 1];
+        slot->in_use = false;
+        slot->next = free_list;
+        free_list = slot;
+    }
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for (size_t i = 0; i < capacity; ++i) {
+        if (slots[i].in_use) {
+            slots[i].get()->~HttpConnection();
+        }
+    }
+
+    std::free(slots);
+}
+
+HttpConnection* ConnectionPool::acquire(HttpServer* server, IoBackend* backend, CompletionQueue* completions, int fd)
+{
+    if (!free_list) {
+        collect();
+        if (!free_list) return nullptr;
+    }
+
+    auto slot = free_list;
+    auto conn = new (&slot->storage) HttpConnection(server, this, backend, completions, fd);
+
+    free_list = slot->next;
+    slot->in_use = true;
+    nused++;
+
+    return conn;
+}
+
+void ConnectionPool::recycle(HttpConnection* conn)
+{
+    auto slot = reinterpret_cast<Slot*>(conn);
+
+    slot->next = recycled.load(std::memory_order_relaxed);
+    while (!recycled.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed))
+        ;
+}
+
+void ConnectionPool::collect()
+{
+    /* taking the whole list at once leaves no room for ABA on the pushing side */
+    auto slot = recycled.exchange(nullptr, std::memory_order_acquire);
+
+    while (slot) {
+        auto next = slot->next;
+
+        slot->get()->~HttpConnection();
+        slot->in_use = false;
+        slot->next = free_list;
+        free_list = slot;
+        nused--;
+
+        slot = next;
+    }
+}
@@ -0,0 +1,160 @@
+#include "epoll_backend.h"
+#include "completion_queue.h"
+#include "http_connection.h"
+#include "output_queue.h"
+#include "reactor.h"
+#include "easylogging++.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdexcept>
+
+EpollBackend::EpollBackend(Reactor* reactor, int listen_fd, bool shared_listen_fd, CompletionQueue* completions)
+    : reactor(reactor), listen_fd(listen_fd), completions(completions),
+      events(std::make_unique<struct epoll_event[]>(MAX_EVENTS))
+{
+    epfd = epoll_create1(EPOLL_FLAGS);
+    if (epfd == -1) {
+        throw std::runtime_error("failed to create epoll");
+    }
+
+    /* the listening socket is the only event source without a connection attached */
+    struct epoll_event ep_event;
+    ep_event.events = EPOLLIN | EPOLLET;
+    /* a socket shared with other processes only wakes one of them for each connection */
+    if (shared_listen_fd) {
+        ep_event.events |= EPOLLEXCLUSIVE;
+    }
+    ep_event.data.ptr = nullptr;
+    epoll_add(listen_fd, &ep_event);
+
+    /* level-triggered, the counter is reset every time the queue is drained */
+    struct epoll_event completion_event;
+    completion_event.events = EPOLLIN;
+    completion_event.data.ptr = completions;
+    epoll_add(completions->get_fd(), &completion_event);
+}
+
+EpollBackend::~EpollBackend()
+{
+    ::close(epfd);
+}
+
+void EpollBackend::poll()
+{
+    int nready = epoll_wait(epfd, events.get(), MAX_EVENTS, -1);
+
+    if (nready < 0) {
+        if (errno == EINTR) {
+            return;
+        } else {
+            throw std::runtime_error("epoll_wait failed");
+        }
+    }
+
+    for (int i = 0; i < nready; ++i) {
+        auto source = events[i].data.ptr;
+
+        if (!source) {
+            handle_accept();
+        } else if (source == completions) {
+            /* responses and stream pieces from the workers, written out right away */
+            completions->drain();
+        } else {
+            auto conn = reinterpret_cast<HttpConnection*>(source);
+
+            /* with edge triggering a writable edge that arrives together with input must not be dropped */
+            if ((events[i].events & EPOLLIN) && !conn->is_closed()) {
+                conn->handle_read_event();
+            }
+            if ((events[i].events & EPOLLOUT) && !conn->is_closed()) {
+                conn->handle_write_event();
+            }
+        }
+    }
+}
+
+void EpollBackend::handle_accept()
+{
+    /* the listening socket is edge-triggered so drain the whole accept queue */
+    while (true) {
+        int conn_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG(ERROR) << "accept error(" << errno << ")";
+            }
+            break;
+        }
+
+        reactor->accept_connection(conn_fd);
+    }
+}
+
+void EpollBackend::add_connection(HttpConnection* conn)
+{
+    struct epoll_event new_event;
+    new_event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    new_event.data.ptr = reinterpret_cast<void*>(conn);
+    epoll_add(conn->get_fd(), &new_event);
+}
+
+ssize_t EpollBackend::write(HttpConnection* conn, OutputQueue& out, bool)
+{
+    /* the write is synchronous, the connection closes the socket itself once out has been written */
+    int fd = conn->get_fd();
+
+    /* sockets run with TCP_NODELAY, a batch that needs more than one system call is corked so that
+     * it is not sent as a string of partial segments */
+    bool cork = out.num_segments() > OutputQueue::MAX_IOVECS || out.num_files() > 0;
+    if (cork) {
+        set_cork(fd, true);
+    }
+
+    ssize_t nwritten = out.flush(fd);
+    int err = errno;
+
+    if (cork) {
+        set_cork(fd, false);
+    }
+
+    /* the rest goes out on the next EPOLLOUT */
+    errno = err;
+    return nwritten;
+}
+
+void EpollBackend::pause_input(HttpConnection*)
+{
+    /* the connection leaves the socket unread, the edge-triggered events do not come back for it */
+}
+
+void EpollBackend::resume_input(HttpConnection* conn)
+{
+    /* the edge for what arrived in the meantime has gone by already */
+    conn->handle_read_event();
+}
+
+void EpollBackend::close(HttpConnection* conn)
+{
+    /* closing the socket takes it out of the epoll set as well */
+    ::close(conn->get_fd());
+}
+
+void EpollBackend::set_cork(int fd, bool on)
+{
+    int opt = on ? 1 : 0;
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt));
+}
+
+void EpollBackend::epoll_add(int fd, struct epoll_event* event)
+{
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, event) == -1) {
+        throw std::runtime_error("cannot add epoll event");
+    }
+}
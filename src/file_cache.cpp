@@ -0,0 +1,111 @@
+#include "file_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+constexpr std::chrono::milliseconds FileCache::REVALIDATE_INTERVAL;
+
+OpenFile::OpenFile(int fd, const struct stat& st) : fd(fd), st(st)
+{
+    format_http_date(st.st_mtime, last_modified);
+}
+
+OpenFile::~OpenFile()
+{
+    ::close(fd);
+}
+
+std::shared_ptr<const OpenFile> FileCache::open(const std::string& path)
+{
+    auto now = Clock::now();
+    std::shared_ptr<const OpenFile> cached;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = index.find(path);
+        if (it != index.end()) {
+            auto& entry = *it->second;
+            lru.splice(lru.begin(), lru, it->second);
+
+            if (now - entry.checked < REVALIDATE_INTERVAL) {
+                return entry.file;
+            }
+            cached = entry.file;
+        }
+    }
+
+    if (cached) {
+        /* still the same file if the path resolves to the same inode, size and mtime; the stat is done
+         * without the lock, like the open below */
+        struct stat st;
+        auto& old = cached->st;
+        bool same = ::stat(path.c_str(), &st) == 0 && st.st_ino == old.st_ino && st.st_dev == old.st_dev &&
+                    st.st_size == old.st_size && st.st_mtim.tv_sec == old.st_mtim.tv_sec &&
+                    st.st_mtim.tv_nsec == old.st_mtim.tv_nsec;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        /* the entry may have been evicted or replaced in the meantime, only the one checked is touched */
+        auto it = index.find(path);
+        if (it != index.end() && it->second->file == cached) {
+            if (same) {
+                it->second->checked = now;
+            } else {
+                lru.erase(it->second);
+                index.erase(it);
+            }
+        }
+
+        if (same) return cached;
+    }
+
+    /* opened without the lock, the file system may be slow */
+    auto file = open_file(path);
+    if (!file) return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = index.find(path);
+    if (it != index.end()) {
+        /* somebody else opened it in the meantime */
+        it->second->file = file;
+        it->second->checked = now;
+        lru.splice(lru.begin(), lru, it->second);
+        return file;
+    }
+
+    lru.push_front(Entry{path, file, now});
+    index[path] = lru.begin();
+
+    if (lru.size() > capacity) {
+        index.erase(lru.back().path);
+        lru.pop_back();
+    }
+
+    return file;
+}
+
+std::shared_ptr<const OpenFile> FileCache::open_file(const std::string& path)
+{
+    /* O_NONBLOCK so that a FIFO in the tree cannot stall the reactor, regular files ignore it */
+    int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return nullptr;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        ::close(fd);
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EACCES;
+        return nullptr;
+    }
+
+    return std::make_shared<const OpenFile>(fd, st);
+}
@@ -1,25 +1,150 @@
 #include "http_connection.h"
+#include "connection_pool.h"
 #include "http_parser.h"
+#include "http_status.h"
 #include "easylogging++.h"
 
 #include <errno.h>
+#include <strings.h>
 #include <unistd.h>
+#include <cstdio>
+#include <cstring>
 #include <stdexcept>
 
-HttpConnection::HttpConnection(HttpServer* server, int epfd, int fd) : server(server), epfd(epfd), fd(fd)
+static const char KEEP_ALIVE_LINE[] = "Connection: keep-alive\r\n";
+static const char CLOSE_LINE[] = "Connection: close\r\n";
+static const char CONTINUE_LINE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+/* a response handed back by a worker, the reference it held on the connection comes along */
+struct HttpConnection::ResponseCompletion : Completion {
+    ResponseCompletion(HttpConnection* conn, PendingResponse* slot, HttpResponse&& response)
+        : conn(conn), slot(slot), response(std::move(response)) { }
+
+    void complete() override
+    {
+        conn->handle_response(slot, std::move(response));
+        conn->release();
+    }
+
+    HttpConnection* conn;
+    PendingResponse* slot;
+    HttpResponse response;
+};
+
+/* a piece of a streamed body produced by a worker */
+struct HttpConnection::StreamCompletion : Completion {
+    StreamCompletion(HttpConnection* conn, PendingResponse* slot, OutputQueue&& body, bool more, bool failed)
+        : conn(conn), slot(slot), body(std::move(body)), more(more), failed(failed) { }
+
+    void complete() override
+    {
+        conn->append_stream(slot, body, more, failed);
+    }
+
+    HttpConnection* conn;
+    PendingResponse* slot;
+    OutputQueue body;
+    bool more;
+    bool failed;
+};
+
+/* a batch of a request body written to its file by a worker */
+struct HttpConnection::SpillCompletion : Completion {
+    SpillCompletion(HttpConnection* conn, HttpRequest* request, PendingResponse* slot, bool failed)
+        : conn(conn), request(request), slot(slot), failed(failed) { }
+
+    void complete() override
+    {
+        conn->spill_written(request, slot, failed);
+    }
+
+    HttpConnection* conn;
+    HttpRequest* request;
+    PendingResponse* slot;
+    bool failed;
+};
+
+HttpConnection::HttpConnection(HttpServer* server, ConnectionPool* pool, IoBackend* backend, CompletionQueue* completions,
+                               int fd)
+    : fd(fd), server(server), pool(pool), backend(backend), completions(completions), refs(1), req_offset(0),
+      request(), read_closed(false), body_request(nullptr), body_slot(nullptr), close_after_write(false),
+      cut_short(false), input_paused(false), closed(false)
+{
+}
+
+bool HttpConnection::retain()
+{
+    int count = refs.load(std::memory_order_relaxed);
+    do {
+        if (count == 0) return false;
+    } while (!refs.compare_exchange_weak(count, count + 1, std::memory_order_relaxed));
+
+    return true;
+}
+
+void HttpConnection::release()
 {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        pool->recycle(this);
+    }
 }
 
 void HttpConnection::handle_read_event()
 {
-    static const ByteBuffer connection_header("Connection", 10);
+    /* the socket is left unread until the output has drained */
+    if (input_paused) return;
+
+    /* a large body goes through the buffer in rounds instead of piling up in it */
+    bool drained;
+    do {
+        drained = read_input();
+        if (is_closed()) return;
+
+        process_input();
+    } while (!drained && !is_closed() && !input_paused);
+
+    check_read_closed();
+}
+
+void HttpConnection::handle_input(const void* data, size_t len)
+{
+    if (len == 0) {
+        read_closed = true;
+    } else {
+        req_buffer.append(data, len);
+    }
+
+    /* what arrives after the input has been paused waits in the buffer */
+    if (!input_paused) {
+        process_input();
+    }
+    check_read_closed();
+}
+
+void HttpConnection::check_read_closed()
+{
+    /* requests may still be waiting in the buffer while the input is paused */
+    if (read_closed && !is_closed() && !input_paused) {
+        /* a request cut off in the middle of its body is never going to be answered */
+        if (body_request || (pending.empty() && out_queue.empty())) {
+            do_close();
+        }
+    }
+}
+
+bool HttpConnection::read_input()
+{
     char buffer[CHUNK_SIZE];
-    req_buffer.clear();
 
-    while (true) {
+    /* req_buffer persists across read events so that a request split over several segments is
+     * parsed incrementally, resuming at req_offset */
+    while (req_buffer.size() < MAX_READ_SIZE) {
         ssize_t nread = read(fd, buffer, CHUNK_SIZE);
 
-        if (nread == 0) break;
+        if (nread == 0) {
+            read_closed = true;
+            return true;
+        }
 
         if (nread < 0) {
             if (errno == EINTR) {
@@ -27,173 +152,705 @@ void HttpConnection::handle_read_event()
             }
 
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                throw std::runtime_error("io read error(" + std::to_string(nread) + ")");
+                LOG(DEBUG) << "io read error(" << errno << "), fd = " << fd;
+                close();
             }
-            break;
+            return true;
         }
         req_buffer.append(buffer, (size_t) nread);
     }
 
-    try {
-        http_parser.parse_http(req_buffer, request);
-    } catch(...) {
+    return false;
+}
+
+void HttpConnection::process_input()
+{
+    /* dispatch every complete request in the buffer; the responses are written back in order */
+    size_t req_start = 0;
+    while (!close_after_write && !is_closed()) {
+        if (body_request) {
+            BodyParser::ParseStatus status;
+            try {
+                status = body_parser.parse_body(req_buffer, req_offset, body_request->body);
+            } catch (const BodyParser::BodyTooLarge&) {
+                body_request = nullptr;
+                reject_request(body_slot, 413);
+                break;
+            } catch (const BodyParser::InvalidChunk&) {
+                body_request = nullptr;
+                reject_request(body_slot, 400);
+                break;
+            } catch (...) {
+                body_request = nullptr;
+                reject_request(body_slot, 500);
+                break;
+            }
+
+            req_start = req_offset;
+            if (status == BodyParser::ParseStatus::NEED_MORE) {
+                auto& body = body_request->body;
+                if (!body_slot->spill_writing && body.unwritten() >= SPILL_BATCH_SIZE) {
+                    write_spill(body_request, body_slot);
+                }
+                /* the rest of the body waits in the socket until the file has caught up */
+                if (body.unwritten() >= SPILL_HIGH_WATER) {
+                    input_paused = true;
+                    backend->pause_input(this);
+                }
+                break;
+            }
+
+            auto request = body_request;
+            body_request = nullptr;
+            finish_body(request, body_slot);
+            continue;
+        }
+
+        /* the rest of the input waits until the client has read some of its responses */
+        if (pending.size() >= MAX_PENDING_RESPONSES || out_queue.size() >= OUTPUT_HIGH_WATER) {
+            input_paused = true;
+            backend->pause_input(this);
+            break;
+        }
+
+        HttpParser::ParseStatus status;
+        try {
+            status = http_parser.parse_http(req_buffer, req_offset, request);
+        } catch(...) {
+            handle_bad_request();
+            break;
+        }
+
+        if (status == HttpParser::ParseStatus::NEED_MORE) {
+            break;
+        }
+
+        req_start = req_offset;
+
+        bool chunked;
+        uint64_t length;
+        if (!frame_body(request, chunked, length)) {
+            handle_bad_request();
+            break;
+        }
+
+        bool keep_alive = is_keep_alive(request);
+        auto slot = add_pending(&request, keep_alive);
+
+        /* refused before the client sends it, or the connection would have to read it all */
+        if (length > server->get_max_body_size()) {
+            reject_request(slot, 413);
+            break;
+        }
+
+        auto materialized = arena.create<HttpRequest>(&arena);
+        request.materialize(req_buffer, *materialized);
+
+        if (chunked || length > 0) {
+            /* a client that waits for the go-ahead before sending the body gets it once the response can be sent */
+            auto expect = request.find_header(HeaderId::EXPECT);
+            if (expect && request.http_major == 1 && request.http_minor >= 1 &&
+                request.header_has_token(req_buffer, expect, "100-continue", 12)) {
+                slot->data.append_static(CONTINUE_LINE, sizeof(CONTINUE_LINE) - 1);
+                flush_responses();
+            }
+
+            materialized->body.set_memory_limit(server->get_body_buffer_size());
+            if (chunked) {
+                body_parser.start_chunked(server->get_max_body_size());
+            } else {
+                body_parser.start_length(length);
+            }
+            body_request = materialized;
+            body_slot = slot;
+            continue;
+        }
+
+        dispatch(materialized, slot);
+    }
+
+    if (close_after_write) {
+        /* nothing more is going to be parsed, whatever the client still sends is dropped */
+        req_buffer.clear();
+        req_offset = 0;
+        request.start = 0;
+    } else {
+        /* keep only the unparsed tail of the buffer, the request in progress moves along with it */
+        req_buffer.consume(req_start);
+        req_offset -= req_start;
+        if (request.start >= req_start) {
+            request.start -= req_start;
+        }
+    }
+    if (req_buffer.size() == 0 && req_buffer.capacity() > RETAINED_BUFFER_SIZE) {
+        req_buffer.shrink();
+    }
+
+    /* while paused the buffer holds complete requests as well */
+    if (!input_paused && req_buffer.size() > MAX_REQUEST_SIZE) {
         handle_bad_request();
     }
+}
 
-    keep_alive = false;
-    auto it = request.headers.find(connection_header);
-    if (it != request.headers.end()) {
-        auto connection_str = it->second.to_string();
-        if (connection_str == "keep-alive" || connection_str == "Keep-Alive") {
-            keep_alive = true;
+void HttpConnection::resume_input()
+{
+    input_paused = false;
+
+    process_input();
+    if (!is_closed() && !input_paused) {
+        backend->resume_input(this);
+    }
+    check_read_closed();
+}
+
+void HttpConnection::dispatch(HttpRequest* request, PendingResponse* slot)
+{
+    /* the worker keeps the connection alive until it has handed over the response */
+    if (!retain()) return;
+
+    server->dispatch_request(*request, arena, [this, slot](HttpResponse&& response) {
+        /* answered natively on the reactor, or by a worker that has to leave the socket alone */
+        if (completions->on_owner_thread()) {
+            this->handle_response(slot, std::move(response));
+            this->release();
+        } else {
+            completions->post(new ResponseCompletion(this, slot, std::move(response)));
         }
+    });
+}
+
+void HttpConnection::finish_body(HttpRequest* request, PendingResponse* slot)
+{
+    slot->body_complete = true;
+
+    /* carried on once the batch in flight has been written */
+    if (slot->spill_writing) return;
+
+    if (request->body.unwritten() > 0) {
+        write_spill(request, slot);
+    } else {
+        dispatch(request, slot);
     }
+}
+
+void HttpConnection::write_spill(HttpRequest* request, PendingResponse* slot)
+{
+    /* the request lives in the arena, the worker keeps the connection alive until the batch is written */
+    if (!retain()) return;
+    slot->spill_writing = true;
+
+    server->run_on_worker([this, request, slot, batch = request->body.take_spill()]() {
+        bool failed = false;
+        try {
+            request->body.write_spill(batch);
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "Request body spill failed: " << e.what();
+            failed = true;
+        }
+
+        completions->post(new SpillCompletion(this, request, slot, failed));
+    });
+}
 
-    try {
-        server->dispatch_request(*this, request, [this](const HttpResponse& response) {
-            this->handle_response(response);
-        });
-    } catch (UrlMap::UnmatchedUrl) {
-        handle_unmatched_url();
+void HttpConnection::spill_written(HttpRequest* request, PendingResponse* slot, bool failed)
+{
+    /* the slot is gone if the connection was closed in the meantime */
+    if (closed) {
+        release();
+        return;
     }
+
+    slot->spill_writing = false;
+
+    if (failed) {
+        if (slot->body_complete) {
+            handle_response(slot, make_error_response(500));
+        } else {
+            /* the rest of the body cannot be stored either */
+            body_request = nullptr;
+            reject_request(slot, 500);
+        }
+    } else if (slot->body_complete) {
+        finish_body(request, slot);
+    } else {
+        if (request->body.unwritten() >= SPILL_BATCH_SIZE) {
+            write_spill(request, slot);
+        }
+        /* input paused for the file to catch up */
+        if (input_paused && request == body_request && request->body.unwritten() < SPILL_HIGH_WATER) {
+            resume_input();
+        }
+    }
+
+    release();
+}
+
+void HttpConnection::reject_request(PendingResponse* slot, int status_code)
+{
+    slot->keep_alive = false;
+    close_after_write = true;
+
+    handle_response(slot, make_error_response(status_code));
 }
 
 void HttpConnection::handle_write_event()
 {
-    if (response.headers.empty() && response.body.size() == 0) return;
+    flush_responses();
+}
 
-    ssize_t nwritten;
-    /* write head */
-    while (true) {
-        nwritten = write(fd, &resp_head[resp_head_offset], resp_head_rem);
+void HttpConnection::handle_written(size_t nwritten)
+{
+    out_queue.consume(nwritten);
+    flush_responses();
+}
 
-        if (nwritten < 0) {
-            if (errno == EINTR) {
-                continue;
-            } if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return;
-            } else {
-                /* TODO: handle error */
+bool HttpConnection::is_keep_alive(const HttpRequestView& request) const
+{
+    /* HTTP/1.1 connections are persistent unless the client asks otherwise, HTTP/1.0 ones only on request */
+    bool keep_alive = request.http_major > 1 || (request.http_major == 1 && request.http_minor >= 1);
+
+    auto header = request.find_header(HeaderId::CONNECTION);
+    if (header) {
+        if (request.header_has_token(req_buffer, header, "close", 5)) {
+            keep_alive = false;
+        } else if (request.header_has_token(req_buffer, header, "keep-alive", 10)) {
+            keep_alive = true;
+        }
+    }
+
+    return keep_alive;
+}
+
+bool HttpConnection::frame_body(const HttpRequestView& request, bool& chunked, uint64_t& length) const
+{
+    chunked = false;
+    length = 0;
+
+    auto base = request.base(req_buffer);
+    const HttpRequestView::Header* transfer_encoding = nullptr;
+    const HttpRequestView::Header* content_length = nullptr;
+
+    /* find_header only knows the first of each while the handler is given the last one, a framing header
+     * that is repeated has to agree with itself or the two would read different bodies */
+    for (size_t i = 0; i < request.num_headers; ++i) {
+        auto& header = request.headers[i];
+
+        if (header.id == HeaderId::TRANSFER_ENCODING) {
+            /* chunked has to be the only coding, a second header can only add another one */
+            if (transfer_encoding) return false;
+            transfer_encoding = &header;
+        } else if (header.id == HeaderId::CONTENT_LENGTH) {
+            if (content_length && (content_length->value.length != header.value.length ||
+                                   std::memcmp(base + content_length->value.offset, base + header.value.offset,
+                                               header.value.length) != 0)) {
+                return false;
             }
+            content_length = &header;
         }
+    }
 
-        if (nwritten == 0) break;
+    if (transfer_encoding) {
+        /* a length next to a transfer coding is how requests are smuggled past intermediaries */
+        if (content_length) return false;
 
-        resp_head_offset += nwritten;
-        resp_head_rem -= nwritten;
+        /* no other coding is supported, and chunked has to be the only one */
+        auto value = base + transfer_encoding->value.offset;
+        chunked = transfer_encoding->value.length == 7 && strncasecmp(reinterpret_cast<const char*>(value), "chunked", 7) == 0;
+        return chunked;
     }
 
-    /* write body */
-    while (true) {
-        nwritten = write(fd, &response.body[resp_body_offset], resp_body_rem);
+    if (content_length) {
+        auto value = base + content_length->value.offset;
+        size_t len = content_length->value.length;
+        if (len == 0 || len > 18) return false;
 
-        if (nwritten < 0) {
-            if (errno == EINTR) {
-                continue;
-            } if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return;
-            } else {
-                /* TODO: handle error */
-            }
+        for (size_t i = 0; i < len; ++i) {
+            if (value[i] < '0' || value[i] > '9') return false;
+            length = length * 10 + (value[i] - '0');
         }
+    }
 
-        if (nwritten == 0) break;
+    return true;
+}
 
-        resp_body_offset += nwritten;
-        resp_body_rem -= nwritten;
+HttpConnection::PendingResponse* HttpConnection::add_pending(const HttpRequestView* request, bool keep_alive)
+{
+    if (!keep_alive) {
+        close_after_write = true;
     }
 
-    if (keep_alive) {
-        reset();
-    } else if (resp_body_rem == 0) {
-        close();
+    pending.emplace_back(&arena);
+    auto& slot = pending.back();
+    if (request) {
+        slot.method = request->method;
+        slot.uri.append(request->base(req_buffer) + request->uri.offset, request->uri.length);
+        slot.http_major = request->http_major;
+        slot.http_minor = request->http_minor;
+    } else {
+        slot.method = HttpMethod::UNKNOWN;
+        slot.http_major = 1;
+        slot.http_minor = 1;
+    }
+    slot.keep_alive = keep_alive;
+    slot.ready = false;
+    slot.chunked = false;
+    slot.stream_paused = false;
+    slot.spill_writing = false;
+    slot.body_complete = false;
+
+    return &slot;
+}
+
+void HttpConnection::handle_response(PendingResponse* slot, HttpResponse&& response)
+{
+    /* the slot is gone if the connection was closed while the request was being handled */
+    if (closed) return;
+
+    LOG(INFO) << '"' << http_method_name(slot->method) << " " << slot->uri
+              << " HTTP/" << slot->http_major << '.' << slot->http_minor << "\" " << response.status_code;
+
+    /* a HEAD request gets the head a GET would, and no body */
+    bool head_only = slot->method == HttpMethod::HEAD;
+
+    if (response.serialized) {
+        /* shared with other responses, only the Connection header is our own */
+        auto& serialized = response.serialized;
+        slot->data.append(std::shared_ptr<const ByteBuffer>(serialized, &serialized->head));
+        if (slot->keep_alive) {
+            slot->data.append_static(KEEP_ALIVE_LINE, sizeof(KEEP_ALIVE_LINE) - 1);
+        } else {
+            slot->data.append_static(CLOSE_LINE, sizeof(CLOSE_LINE) - 1);
+        }
+        slot->data.append(current_date_header());
+        size_t tail_size = serialized->tail.size() - (head_only ? serialized->body_size : 0);
+        slot->data.append_shared(serialized, serialized->tail.data(), tail_size);
+        slot->ready = true;
+
+        flush_responses();
+        return;
+    }
+
+    if (response.stream) {
+        slot->chunked = slot->http_major > 1 || (slot->http_major == 1 && slot->http_minor >= 1);
+        if (slot->chunked) {
+            response.headers.set(HeaderId::TRANSFER_ENCODING, "chunked", 7);
+        } else if (!head_only) {
+            /* without chunked encoding only the end of the connection marks the end of the body */
+            slot->keep_alive = false;
+            close_after_write = true;
+        }
+    }
+
+    ByteBuffer head;
+    build_resp_head(response, slot->keep_alive, head);
+    if (head_only) {
+        slot->data.append(std::move(head));
+        slot->ready = true;
+
+        flush_responses();
+        return;
+    }
+
+    if (response.body.size() <= COALESCE_BODY_SIZE) {
+        head.append(response.body);
+        if (response.body_length > 0 && response.body_length <= COALESCE_BODY_SIZE) {
+            head.append(response.body_data, response.body_length);
+            response.body_owner.reset();
+        }
+        slot->data.append(std::move(head));
+    } else {
+        slot->data.append(std::move(head));
+        slot->data.append(std::move(response.body));
+    }
+    if (response.body_owner) {
+        slot->data.append_shared(std::move(response.body_owner), response.body_data, response.body_length);
+    }
+    if (response.file) {
+        slot->data.append_file(std::move(response.file), response.file_offset, response.file_length);
+    }
+
+    if (!response.stream) {
+        slot->ready = true;
+        flush_responses();
+        return;
+    }
+
+    /* the head goes out right away, the stream keeps the connection alive until it is complete */
+    slot->stream = std::move(response.stream);
+    retain();
+    flush_responses();
+
+    /* the first piece is asked for once the head is out, so that it can follow as soon as it is there */
+    if (closed) {
+        release();
+        return;
+    }
+    schedule_stream(slot);
+}
+
+void HttpConnection::schedule_stream(PendingResponse* slot)
+{
+    slot->stream_paused = false;
+
+    /* a client that has been sent everything is waiting, it gets the next piece as soon as there is one */
+    size_t max_bytes = STREAM_PIECE_SIZE;
+    if (out_queue.empty() && slot->data.empty()) {
+        max_bytes = 1;
+    }
+
+    server->run_on_worker([this, slot, stream = slot->stream, max_bytes]() {
+        OutputQueue body;
+        bool more = false;
+        bool failed = false;
+        try {
+            more = stream->produce(body, max_bytes);
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "Response stream failed: " << e.what();
+            failed = true;
+        }
+
+        completions->post(new StreamCompletion(this, slot, std::move(body), more, failed));
+    });
+}
+
+void HttpConnection::append_stream(PendingResponse* slot, OutputQueue& body, bool more, bool failed)
+{
+    /* the slot is gone if the connection was closed in the meantime, and so is the stream's reference */
+    if (closed) {
+        release();
+        return;
+    }
+
+    if (body.size() > 0) {
+        if (slot->chunked) {
+            char size_line[24];
+            int len = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", body.size());
+            slot->data.append(ByteBuffer(size_line, (size_t) len));
+            slot->data.splice(body);
+            slot->data.append_static("\r\n", 2);
+        } else {
+            slot->data.splice(body);
+        }
+    }
+
+    if (failed) {
+        /* The head has gone out already, all that is left is to cut the response short. What has been
+         * produced before still goes out if the response is the one being written. */
+        slot->stream.reset();
+        if (slot == &pending.front()) {
+            out_queue.splice(slot->data);
+            close_after_write = true;
+            cut_short = true;
+            flush_responses();
+        } else {
+            do_close();
+        }
+        release();
+        return;
+    }
+
+    if (!more) {
+        if (slot->chunked) {
+            slot->data.append_static("0\r\n\r\n", 5);
+        }
+        slot->stream.reset();
+        slot->ready = true;
+    } else if (out_queue.size() + slot->data.size() >= STREAM_HIGH_WATER) {
+        /* resumed by flush_responses once the client has caught up */
+        slot->stream_paused = true;
+    } else {
+        schedule_stream(slot);
+    }
+
+    flush_responses();
+
+    /* otherwise the reference goes along with the stream */
+    if (!more) {
+        release();
     }
 }
 
-void HttpConnection::handle_response(const HttpResponse& response)
+void HttpConnection::flush_responses()
 {
-    LOG(INFO) << '"' << http_method_name(request.method) << " " << request.uri
-              << " HTTP/" << request.http_major << '.' << request.http_minor << "\" " << response.status_code;
+    if (closed) return;
+
+    /* queue the responses that are ready, in request order, so that they go out together; of a response
+     * still being streamed, what has been produced so far */
+    while (!pending.empty() && !cut_short) {
+        auto& front = pending.front();
+        out_queue.splice(front.data);
+        if (!front.ready) break;
+        pending.pop_front();
+    }
+
+    /* every request so far has been answered, nothing refers into the arena anymore */
+    if (pending.empty()) {
+        arena.reset();
+    }
+
+    if (!out_queue.empty()) {
+        /* the connection goes away once this has been written */
+        bool last = cut_short || (pending.empty() && (close_after_write || read_closed));
+
+        ssize_t nwritten = backend->write(this, out_queue, last);
+        if (nwritten < 0) {
+            LOG(DEBUG) << "io write error(" << errno << "), fd = " << fd;
+            do_close();
+            return;
+        }
+    }
+
+    /* streams that were waiting for the client go on once it has caught up */
+    for (auto& slot : pending) {
+        if (slot.stream_paused && out_queue.size() + slot.data.size() < STREAM_LOW_WATER) {
+            schedule_stream(&slot);
+        }
+    }
+
+    /* paused input is taken up again once the client has caught up */
+    if (input_paused && pending.empty() && out_queue.size() < OUTPUT_LOW_WATER) {
+        resume_input();
+        if (closed) return;
+    }
 
-    this->response = response;
-    build_resp_head(response, resp_head);
-    resp_head_offset = 0;
-    resp_head_rem = resp_head.size();
-    resp_body_offset = 0;
-    resp_body_rem = response.body.size();
+    /* the rest goes out once the socket takes more */
+    if (!out_queue.empty()) return;
 
-    handle_write_event();
+    if (cut_short || (pending.empty() && (close_after_write || read_closed))) {
+        do_close();
+    }
 }
 
-void HttpConnection::build_resp_head(const HttpResponse& response, ByteBuffer& buf)
+void HttpConnection::build_resp_head(const HttpResponse& response, bool keep_alive, ByteBuffer& buf)
 {
-    buf.append("HTTP/1.1 ", 9);
-    buf.append(ByteBuffer(std::to_string(response.status_code)));
-    buf.append(" \r\nServer: Porgi\r\nConnection: ", 30);
+    build_status_line(response, buf);
     if (keep_alive) {
-        buf.append("keep-alive", 10);
+        buf.append(KEEP_ALIVE_LINE, sizeof(KEEP_ALIVE_LINE) - 1);
     } else {
-        buf.append("close", 5);
+        buf.append(CLOSE_LINE, sizeof(CLOSE_LINE) - 1);
+    }
+    buf.append(*current_date_header());
+    build_resp_fields(response, buf);
+}
+
+void HttpConnection::build_status_line(const HttpResponse& response, ByteBuffer& buf)
+{
+    append_status_line(response.status_code, buf);
+}
+
+void HttpConnection::build_resp_fields(const HttpResponse& response, ByteBuffer& buf)
+{
+    /* a 304 describes the representation it stands for, it must not claim an empty one */
+    if (response.status_code != 304 && !response.stream) {
+        buf.append("Content-length: ", 16);
+        buf.append_decimal(response.content_length());
+        buf.append("\r\n", 2);
     }
-    buf.append("\r\nContent-length: ", 18);
-    buf.append(ByteBuffer(std::to_string(response.body.size())));
-    buf.append("\r\n", 2);
 
     for (auto& it : response.headers) {
-        buf.append(it.first);
+        buf.append(it.name);
         buf.append(": ", 2);
-        buf.append(it.second);
+        buf.append(it.value);
         buf.append("\r\n", 2);
     }
     buf.append("\r\n", 2);
 }
 
+std::shared_ptr<const SerializedResponse> HttpConnection::serialize_response(const HttpResponse& response)
+{
+    if (response.file || response.stream) return nullptr;
+
+    auto serialized = std::make_shared<SerializedResponse>();
+    serialized->status_code = response.status_code;
+    build_status_line(response, serialized->head);
+    build_resp_fields(response, serialized->tail);
+    serialized->tail.append(response.body);
+    if (response.body_owner) {
+        serialized->tail.append(response.body_data, response.body_length);
+    }
+    serialized->body_size = response.body.size() + response.body_length;
+
+    return serialized;
+}
+
 void HttpConnection::close()
 {
-    ::close(fd);
+    do_close();
 }
 
-void HttpConnection::reset()
+void HttpConnection::do_close()
 {
-    resp_head.clear();
-    resp_head_offset = 0;
-    resp_body_offset = 0;
-    resp_head_rem = 0;
-    resp_body_rem = 0;
+    if (closed) return;
+
+    closed = true;
+    /* a paused stream holds a reference that no worker is going to give back */
+    for (auto& slot : pending) {
+        if (slot.stream_paused) {
+            release();
+        }
+    }
+    pending.clear();
+    /* a write still in flight goes on reading from the queue, it is freed along with the connection then */
+    if (!io_state.writing) {
+        out_queue.clear();
+    }
+    backend->close(this);
+
+    /* the reactor's reference, the slot goes back to the pool once the workers are done with it */
+    release();
 }
 
 void HttpConnection::handle_bad_request()
 {
-    HttpResponse response;
-    response.status_code = 400;
-    response.headers[ByteBuffer("Content-Type")] = ByteBuffer("text/html");
-    response.body = ByteBuffer(
-#include "templates/400.inc"
-    );
-    keep_alive = false;
-    handle_response(response);
+    http_parser.reset();
+    req_buffer.clear();
+    req_offset = 0;
+
+    handle_response(add_pending(nullptr, false), make_error_response(400));
 }
 
-void HttpConnection::handle_unmatched_url()
+static std::shared_ptr<const SerializedResponse> serialize_error(int status_code, const char* body)
 {
     HttpResponse response;
-    response.status_code = 404;
-    response.headers[ByteBuffer("Content-Type")] = ByteBuffer("text/html");
-    response.body = ByteBuffer(
-#include "templates/404.inc"
-    );
-    keep_alive = false;
-    handle_response(response);
+    response.status_code = status_code;
+    response.headers.set(HeaderId::CONTENT_TYPE, "text/html", 9);
+    response.body = ByteBuffer(body, std::strlen(body));
+
+    return HttpConnection::serialize_response(response);
 }
 
-void HttpConnection::handle_internal_error()
+HttpResponse HttpConnection::make_error_response(int status_code)
 {
-    HttpResponse response;
-    response.status_code = 500;
-    response.headers[ByteBuffer("Content-Type")] = ByteBuffer("text/html");
-    response.body = ByteBuffer(
+    /* serialized once and shared by every connection that sends them */
+    static const auto bad_request = serialize_error(400,
+#include "templates/400.inc"
+    );
+    static const auto not_found = serialize_error(404,
+#include "templates/404.inc"
+    );
+    static const auto payload_too_large = serialize_error(413,
+#include "templates/413.inc"
+    );
+    static const auto internal_error = serialize_error(500,
 #include "templates/500.inc"
     );
-    keep_alive = false;
-    handle_response(response);
+
+    HttpResponse response;
+    switch (status_code) {
+    case 400:
+        response.serialized = bad_request;
+        break;
+    case 404:
+        response.serialized = not_found;
+        break;
+    case 413:
+        response.serialized = payload_too_large;
+        break;
+    default:
+        response.serialized = internal_error;
+        break;
+    }
+    response.status_code = response.serialized->status_code;
+
+    return response;
 }
@@ -0,0 +1,78 @@
+#include "http_date.h"
+
+#include <cstring>
+
+static const char* const day_names[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char* const month_names[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                           "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static inline void put2(char* p, int v)
+{
+    p[0] = (char) ('0' + v / 10);
+    p[1] = (char) ('0' + v % 10);
+}
+
+void format_http_date(time_t t, char* buf)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+
+    /* formatted by hand, strftime would follow the locale */
+    std::memcpy(buf, day_names[tm.tm_wday], 3);
+    std::memcpy(buf + 3, ", ", 2);
+    put2(buf + 5, tm.tm_mday);
+    buf[7] = ' ';
+    std::memcpy(buf + 8, month_names[tm.tm_mon], 3);
+    buf[11] = ' ';
+    int year = tm.tm_year + 1900;
+    put2(buf + 12, year / 100);
+    put2(buf + 14, year % 100);
+    buf[16] = ' ';
+    put2(buf + 17, tm.tm_hour);
+    buf[19] = ':';
+    put2(buf + 20, tm.tm_min);
+    buf[22] = ':';
+    put2(buf + 23, tm.tm_sec);
+    std::memcpy(buf + 25, " GMT", 4);
+}
+
+static bool get_number(const char* p, size_t n, int& value)
+{
+    value = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] < '0' || p[i] > '9') return false;
+        value = value * 10 + (p[i] - '0');
+    }
+    return true;
+}
+
+bool parse_http_date(const char* str, size_t len, time_t& t)
+{
+    if (len != HTTP_DATE_LENGTH || str[3] != ',' || str[4] != ' ' || str[7] != ' ' || str[11] != ' ' ||
+        str[16] != ' ' || str[19] != ':' || str[22] != ':' || std::memcmp(str + 25, " GMT", 4) != 0) {
+        return false;
+    }
+
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+
+    int year;
+    if (!get_number(str + 5, 2, tm.tm_mday) || !get_number(str + 12, 4, year) ||
+        !get_number(str + 17, 2, tm.tm_hour) || !get_number(str + 20, 2, tm.tm_min) ||
+        !get_number(str + 23, 2, tm.tm_sec)) {
+        return false;
+    }
+    tm.tm_year = year - 1900;
+
+    tm.tm_mon = -1;
+    for (int i = 0; i < 12; ++i) {
+        if (std::memcmp(str + 8, month_names[i], 3) == 0) {
+            tm.tm_mon = i;
+            break;
+        }
+    }
+    if (tm.tm_mon < 0) return false;
+
+    t = timegm(&tm);
+    return t != (time_t) -1;
+}
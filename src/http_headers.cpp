@@ -0,0 +1,250 @@
+#include "http_headers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+#include <utility>
+
+struct KnownHeader {
+    HeaderId id;
+    const char* name;
+    size_t len;
+};
+
+#define DEF_KNOWN_HEADER(id, name) { HeaderId::id, name, sizeof(name) - 1 }
+static const KnownHeader known_headers[] = {
+    { HeaderId::OTHER, "", 0 },
+    DEF_KNOWN_HEADER(ACCEPT, "Accept"),
+    DEF_KNOWN_HEADER(ACCEPT_ENCODING, "Accept-Encoding"),
+    DEF_KNOWN_HEADER(ACCEPT_LANGUAGE, "Accept-Language"),
+    DEF_KNOWN_HEADER(AUTHORIZATION, "Authorization"),
+    DEF_KNOWN_HEADER(CACHE_CONTROL, "Cache-Control"),
+    DEF_KNOWN_HEADER(CONNECTION, "Connection"),
+    DEF_KNOWN_HEADER(CONTENT_ENCODING, "Content-Encoding"),
+    DEF_KNOWN_HEADER(CONTENT_LENGTH, "Content-Length"),
+    DEF_KNOWN_HEADER(CONTENT_TYPE, "Content-Type"),
+    DEF_KNOWN_HEADER(COOKIE, "Cookie"),
+    DEF_KNOWN_HEADER(DATE, "Date"),
+    DEF_KNOWN_HEADER(EXPECT, "Expect"),
+    DEF_KNOWN_HEADER(HOST, "Host"),
+    DEF_KNOWN_HEADER(IF_MODIFIED_SINCE, "If-Modified-Since"),
+    DEF_KNOWN_HEADER(IF_NONE_MATCH, "If-None-Match"),
+    DEF_KNOWN_HEADER(IF_RANGE, "If-Range"),
+    DEF_KNOWN_HEADER(LAST_MODIFIED, "Last-Modified"),
+    DEF_KNOWN_HEADER(ORIGIN, "Origin"),
+    DEF_KNOWN_HEADER(RANGE, "Range"),
+    DEF_KNOWN_HEADER(REFERER, "Referer"),
+    DEF_KNOWN_HEADER(TRANSFER_ENCODING, "Transfer-Encoding"),
+    DEF_KNOWN_HEADER(UPGRADE, "Upgrade"),
+    DEF_KNOWN_HEADER(USER_AGENT, "User-Agent"),
+    DEF_KNOWN_HEADER(X_FORWARDED_FOR, "X-Forwarded-For"),
+};
+#undef DEF_KNOWN_HEADER
+
+static_assert(sizeof(known_headers) / sizeof(known_headers[0]) == (size_t) HeaderId::COUNT,
+              "every HeaderId needs a name");
+
+HeaderId lookup_header_id(const void* name, size_t len)
+{
+    /* the lengths of the known names are mostly distinct so this rarely gets to the compare */
+    for (size_t i = 1; i < (size_t) HeaderId::COUNT; ++i) {
+        auto& known = known_headers[i];
+        if (known.len == len && strncasecmp(known.name, static_cast<const char*>(name), len) == 0) {
+            return known.id;
+        }
+    }
+
+    return HeaderId::OTHER;
+}
+
+const char* header_id_name(HeaderId id)
+{
+    return known_headers[(size_t) id].name;
+}
+
+HeaderMap::HeaderMap(Arena* arena) : arena(arena), count(0), overflow(ArenaAllocator<Entry>(arena))
+{
+    std::memset(by_id, 0, sizeof(by_id));
+}
+
+HeaderMap::HeaderMap(const HeaderMap& other) : HeaderMap()
+{
+    *this = other;
+}
+
+HeaderMap::HeaderMap(HeaderMap&& other) noexcept : HeaderMap(other.arena)
+{
+    *this = std::move(other);
+}
+
+HeaderMap::~HeaderMap()
+{
+    clear();
+}
+
+HeaderMap& HeaderMap::operator=(const HeaderMap& rhs)
+{
+    if (this == &rhs) return *this;
+
+    clear();
+    for (auto& it : rhs) {
+        append(it.id, it.name.data(), it.name.size(), it.value.data(), it.value.size());
+    }
+    return *this;
+}
+
+HeaderMap& HeaderMap::operator=(HeaderMap&& rhs) noexcept
+{
+    if (this == &rhs) return *this;
+
+    clear();
+    if (rhs.arena != arena) {
+        /* the entries cannot be taken over from another arena */
+        *this = static_cast<const HeaderMap&>(rhs);
+        rhs.clear();
+        return *this;
+    }
+
+    size_t ninline = std::min(rhs.count, INLINE_ENTRIES);
+    for (size_t i = 0; i < ninline; ++i) {
+        new (&inline_entries()[i]) Entry(std::move(rhs.inline_entries()[i]));
+    }
+    overflow.swap(rhs.overflow);
+    count = rhs.count;
+    std::memcpy(by_id, rhs.by_id, sizeof(by_id));
+
+    rhs.clear();
+    return *this;
+}
+
+HeaderMap::Entry& HeaderMap::entry(size_t index)
+{
+    return index < INLINE_ENTRIES ? inline_entries()[index] : overflow[index - INLINE_ENTRIES];
+}
+
+const HeaderMap::Entry& HeaderMap::entry(size_t index) const
+{
+    return index < INLINE_ENTRIES ? inline_entries()[index] : overflow[index - INLINE_ENTRIES];
+}
+
+int HeaderMap::find(HeaderId id, const void* name, size_t len) const
+{
+    if (id != HeaderId::OTHER) {
+        return (int) by_id[(size_t) id] - 1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        auto& it = entry(i);
+        if (it.id == HeaderId::OTHER && it.name.size() == len &&
+            strncasecmp(reinterpret_cast<const char*>(it.name.data()), static_cast<const char*>(name), len) == 0) {
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+const ByteBuffer* HeaderMap::get(HeaderId id) const
+{
+    auto index = by_id[(size_t) id];
+    return index ? &entry(index - 1).value : nullptr;
+}
+
+const ByteBuffer* HeaderMap::get(const void* name, size_t len) const
+{
+    int index = find(lookup_header_id(name, len), name, len);
+    return index >= 0 ? &entry((size_t) index).value : nullptr;
+}
+
+HeaderMap::Entry& HeaderMap::append(HeaderId id, const void* name, size_t name_len, const void* value, size_t value_len)
+{
+    if (count < INLINE_ENTRIES) {
+        new (&inline_entries()[count]) Entry{id, ByteBuffer(name, name_len, arena), ByteBuffer(value, value_len, arena)};
+    } else {
+        overflow.push_back(Entry{id, ByteBuffer(name, name_len, arena), ByteBuffer(value, value_len, arena)});
+    }
+
+    if (id != HeaderId::OTHER) {
+        by_id[(size_t) id] = (uint16_t) (count + 1);
+    }
+
+    return entry(count++);
+}
+
+void HeaderMap::set(HeaderId id, const void* name, size_t name_len, const void* value, size_t value_len)
+{
+    int index = find(id, name, name_len);
+    if (index >= 0) {
+        auto& entry_value = entry((size_t) index).value;
+        entry_value.clear();
+        entry_value.append(value, value_len);
+    } else {
+        append(id, name, name_len, value, value_len);
+    }
+}
+
+void HeaderMap::set(HeaderId id, const void* value, size_t value_len)
+{
+    auto& known = known_headers[(size_t) id];
+    set(id, known.name, known.len, value, value_len);
+}
+
+void HeaderMap::set(const ByteBuffer& name, const ByteBuffer& value)
+{
+    set(lookup_header_id(name.data(), name.size()), name, value);
+}
+
+ByteBuffer& HeaderMap::operator[](const ByteBuffer& name)
+{
+    auto id = lookup_header_id(name.data(), name.size());
+    int index = find(id, name.data(), name.size());
+    if (index >= 0) {
+        return entry((size_t) index).value;
+    }
+
+    return append(id, name.data(), name.size(), nullptr, 0).value;
+}
+
+bool HeaderMap::erase(const ByteBuffer& name)
+{
+    int index = find(lookup_header_id(name.data(), name.size()), name.data(), name.size());
+    if (index < 0) return false;
+
+    /* shift the following entries down to keep insertion order */
+    for (size_t i = (size_t) index; i + 1 < count; ++i) {
+        entry(i) = std::move(entry(i + 1));
+    }
+
+    if (count > INLINE_ENTRIES) {
+        overflow.pop_back();
+    } else {
+        inline_entries()[count - 1].~Entry();
+    }
+    count--;
+
+    reindex();
+    return true;
+}
+
+void HeaderMap::clear()
+{
+    size_t ninline = std::min(count, INLINE_ENTRIES);
+    for (size_t i = 0; i < ninline; ++i) {
+        inline_entries()[i].~Entry();
+    }
+    overflow.clear();
+
+    count = 0;
+    std::memset(by_id, 0, sizeof(by_id));
+}
+
+void HeaderMap::reindex()
+{
+    std::memset(by_id, 0, sizeof(by_id));
+    for (size_t i = 0; i < count; ++i) {
+        auto id = entry(i).id;
+        if (id != HeaderId::OTHER) {
+            by_id[(size_t) id] = (uint16_t) (i + 1);
+        }
+    }
+}
@@ -1,29 +1,47 @@
 #include "http_parser.h"
+#include "http_tokenizer.h"
 
-#include <unordered_map>
-#include <string>
 #include <cctype>
+#include <cstring>
 
-static std::unordered_map<HttpMethod, std::string> method_strings =
-    {
-#define DEF_METHOD_STRING(name) { HttpMethod::name, #name }
-     DEF_METHOD_STRING(GET),
-    };
-
-static bool is_uri_char(char ch)
+HttpParser::HttpParser()
 {
-    return isalpha(ch) || isdigit(ch) || (ch == '_') || (ch == '/') || (ch == '.');
+    reset();
 }
 
-HttpParser::HttpParser()
+void HttpParser::reset()
 {
     state = RequestParseState::START_REQ;
 }
 
-void HttpParser::parse_http(const ByteBuffer& req_buf, HttpRequest& request)
+HttpParser::ParseStatus HttpParser::parse_http(const ByteBuffer& req_buf, size_t& offset, HttpRequestView& request)
 {
-    for (auto p = std::begin(req_buf); p != std::end(req_buf); ++p) {
+    auto end = std::end(req_buf);
+
+    for (auto p = std::begin(req_buf) + offset; p != end; ++p) {
+        /* skip over runs of ordinary characters, the state machine only sees delimiters and invalid input */
+        switch (state) {
+        case RequestParseState::PATH:
+            p = HttpTokenizer::scan_path(p, end);
+            break;
+        case RequestParseState::QUERY_STRING_START:
+            p = HttpTokenizer::scan_query(p, end);
+            break;
+        case RequestParseState::HEADER_FIELD:
+            p = HttpTokenizer::scan_token(p, end);
+            break;
+        case RequestParseState::HEADER_VALUE:
+        case RequestParseState::HEADER_SPACE_AFTER_VALUE:
+            p = skip_header_value(req_buf, p, request);
+            break;
+        default:
+            break;
+        }
+        if (p == end) break;
+
         auto ch = *p;
+        /* position relative to the start of the request */
+        auto pos = (uint32_t) (p - std::begin(req_buf) - request.start);
 
         switch (state) {
         case RequestParseState::START_REQ:
@@ -34,41 +52,31 @@ void HttpParser::parse_http(const ByteBuffer& req_buf, HttpRequest& request)
                 throw HttpParser::InvalidMethod("invalid method");
             }
 
-            method = HttpMethod::UNKNOWN;
-            switch (ch) {
-            case 'G':
-                method = HttpMethod::GET;
-                break;
-            default:
-                throw HttpParser::InvalidMethod("invalid method");
-            }
-            method_index = 1;
+            request.start = p - std::begin(req_buf);
+            request.num_headers = 0;
+            std::memset(request.header_index, 0, sizeof(request.header_index));
+            request.query_string = Slice{0, 0};
             state = RequestParseState::METHOD;
             break;
 
         case RequestParseState::METHOD:
-            {
-                auto& match = method_strings[method];
-
-                if (ch == ' ' && method_index == match.length()) {
-                    state = RequestParseState::SPACES_BEFORE_URI;
-                    request.method = method;
-                } else if (ch == match[method_index]) {
-
-                } else if (ch < 'A' || ch > 'Z') {
+            if (ch == ' ') {
+                /* the method is the first pos bytes of the request */
+                request.method = lookup_http_method(request.base(req_buf), pos);
+                if (request.method == HttpMethod::UNKNOWN) {
                     throw HttpParser::InvalidMethod("invalid method");
                 }
-
-                method_index++;
-                break;
+                state = RequestParseState::SPACES_BEFORE_URI;
+            } else if (ch < 'A' || ch > 'Z' || pos >= MAX_METHOD_LENGTH) {
+                throw HttpParser::InvalidMethod("invalid method");
             }
+            break;
 
         case RequestParseState::SPACES_BEFORE_URI:
             if (ch == ' ') break;
 
             if (ch == '/') {
-                uri_buffer.clear();
-                uri_buffer.append(p, 1);
+                token_start = pos;
                 state = RequestParseState::PATH;
             } else {
                 throw HttpParser::InvalidURI("invalid URI");
@@ -79,7 +87,7 @@ void HttpParser::parse_http(const ByteBuffer& req_buf, HttpRequest& request)
             switch (ch) {
             case ' ':
                 state = RequestParseState::HTTP_START;
-                request.uri = std::move(uri_buffer);
+                request.uri = Slice{token_start, pos - token_start};
                 break;
             default:
                 state = parse_uri_char(ch);
@@ -87,11 +95,23 @@ void HttpParser::parse_http(const ByteBuffer& req_buf, HttpRequest& request)
                     throw HttpParser::InvalidURI("invalid URI");
                 }
 
-                uri_buffer.append(p, 1);
+                if (state == RequestParseState::QUERY_STRING_START) {
+                    request.uri = Slice{token_start, pos - token_start};
+                    token_start = pos + 1;
+                }
                 break;
             }
             break;
 
+        case RequestParseState::QUERY_STRING_START:
+            if (ch == ' ') {
+                state = RequestParseState::HTTP_START;
+                request.query_string = Slice{token_start, pos - token_start};
+            } else if (!HttpTokenizer::is_query_char(ch)) {
+                throw HttpParser::InvalidURI("invalid URI");
+            }
+            break;
+
         case RequestParseState::HTTP_START:
             switch (ch) {
             case 'H':
@@ -105,18 +125,30 @@ void HttpParser::parse_http(const ByteBuffer& req_buf, HttpRequest& request)
             break;
 
         case RequestParseState::HTTP_H:
+            if (ch != 'T') {
+                throw HttpParser::InvalidConstant("invalid constant");
+            }
             state = RequestParseState::HTTP_HT;
             break;
 
         case RequestParseState::HTTP_HT:
+            if (ch != 'T') {
+                throw HttpParser::InvalidConstant("invalid constant");
+            }
             state = RequestParseState::HTTP_HTT;
             break;
 
         case RequestParseState::HTTP_HTT:
+            if (ch != 'P') {
+                throw HttpParser::InvalidConstant("invalid constant");
+            }
             state = RequestParseState::HTTP_HTTP;
             break;
 
         case RequestParseState::HTTP_HTTP:
+            if (ch != '/') {
+                throw HttpParser::InvalidConstant("invalid constant");
+            }
             state = RequestParseState::HTTP_MAJOR;
             break;
 
@@ -168,12 +200,20 @@ void HttpParser::parse_http(const ByteBuffer& req_buf, HttpRequest& request)
                 state = RequestParseState::HEADERS_ALMOST_DONE;
                 break;
             case '\n':
-                state = RequestParseState::HEADERS_ALMOST_DONE;
-                break;
+                /* bare LF terminates the header block */
+                state = RequestParseState::START_REQ;
+                offset = p - std::begin(req_buf) + 1;
+                return ParseStatus::COMPLETE;
             default:
+                if (!HttpTokenizer::is_token_char(ch)) {
+                    throw InvalidHeader("invalid header");
+                }
+                if (request.num_headers == HttpRequestView::MAX_HEADERS) {
+                    throw TooManyHeaders("too many headers");
+                }
+
                 state = RequestParseState::HEADER_FIELD;
-                last_header_name.clear();
-                last_header_name.append(p, 1);
+                token_start = pos;
                 break;
             }
             break;
@@ -181,83 +221,125 @@ void HttpParser::parse_http(const ByteBuffer& req_buf, HttpRequest& request)
         case RequestParseState::HEADER_FIELD:
             switch (ch) {
             case ':':
-                state = RequestParseState::HEADER_VALUE_START;
-                break;
-            case '\r':
-                state = RequestParseState::HEADER_ALMOST_DONE;
+                {
+                    state = RequestParseState::HEADER_VALUE_START;
+
+                    auto& header = request.headers[request.num_headers];
+                    header.name = Slice{token_start, pos - token_start};
+                    header.id = lookup_header_id(request.base(req_buf) + token_start, header.name.length);
+                }
+                token_start = value_end = pos + 1;
                 break;
             default:
-                last_header_name.append(p, 1);
+                if (!HttpTokenizer::is_token_char(ch)) {
+                    throw InvalidHeader("invalid header");
+                }
                 break;
             }
             break;
 
         case RequestParseState::HEADER_VALUE_START:
-            if (ch != ' ') {
-                throw InvalidHeader("invalid header");
-            }
-
-            state = RequestParseState::HEADER_SPACE_BEFORE_VALUE;
-            break;
-
         case RequestParseState::HEADER_SPACE_BEFORE_VALUE:
             switch (ch) {
             case ' ':
+            case '\t':
+                state = RequestParseState::HEADER_SPACE_BEFORE_VALUE;
+                token_start = value_end = pos + 1;
                 break;
             case '\r':
                 state = RequestParseState::HEADER_ALMOST_DONE;
                 break;
+            case '\n':
+                add_header(request);
+                state = RequestParseState::HEADER_FIELD_START;
+                break;
             default:
-                last_header_value.clear();
-                last_header_value.append(p, 1);
+                if (!HttpTokenizer::is_value_char(ch)) {
+                    throw InvalidHeader("invalid header");
+                }
+                value_end = pos + 1;
                 state = RequestParseState::HEADER_VALUE;
                 break;
             }
             break;
 
         case RequestParseState::HEADER_VALUE:
+        case RequestParseState::HEADER_SPACE_AFTER_VALUE:
             switch (ch) {
             case '\r':
                 state = RequestParseState::HEADER_ALMOST_DONE;
                 break;
-            case ' ':
-                state = RequestParseState::HEADER_SPACE_AFTER_VALUE;
-                break;
-            default:
-                last_header_value.append(p, 1);
+            case '\n':
+                add_header(request);
+                state = RequestParseState::HEADER_FIELD_START;
                 break;
-            }
-            break;
-
-        case RequestParseState::HEADER_SPACE_AFTER_VALUE:
-            switch (ch) {
             case ' ':
-                break;
-            case '\r':
-                state = RequestParseState::HEADER_ALMOST_DONE;
+            case '\t':
+                /* trailing whitespace is not part of the value */
+                state = RequestParseState::HEADER_SPACE_AFTER_VALUE;
                 break;
             default:
+                if (!HttpTokenizer::is_value_char(ch)) {
+                    throw InvalidHeader("invalid header");
+                }
+                value_end = pos + 1;
                 state = RequestParseState::HEADER_VALUE;
-                last_header_value.append(" ", 1);
-                last_header_value.append(p, 1);
                 break;
             }
             break;
 
         case RequestParseState::HEADER_ALMOST_DONE:
-            request.headers[last_header_name] = last_header_value;
+            if (ch != '\n') {
+                throw HttpParser::LFExpected("LF character expected");
+            }
+
+            add_header(request);
             state = RequestParseState::HEADER_FIELD_START;
             break;
 
         case RequestParseState::HEADERS_ALMOST_DONE:
-            state = RequestParseState::FINISH;
-            break;
+            if (ch != '\n') {
+                throw HttpParser::LFExpected("LF character expected");
+            }
 
-        case RequestParseState::FINISH:
             state = RequestParseState::START_REQ;
-            return;
+            offset = p - std::begin(req_buf) + 1;
+            return ParseStatus::COMPLETE;
+
+        case RequestParseState::FINISH:
+            break;
         }
     }
+
+    offset = req_buf.size();
+    return ParseStatus::NEED_MORE;
+}
+
+const uint8_t* HttpParser::skip_header_value(const ByteBuffer& req_buf, const uint8_t* p, HttpRequestView& request)
+{
+    auto value_stop = HttpTokenizer::scan_value(p, std::end(req_buf));
+
+    /* the value extends to the last non-whitespace character that was skipped */
+    for (auto q = value_stop; q != p; --q) {
+        if (q[-1] != ' ' && q[-1] != '\t') {
+            value_end = (uint32_t) (q - request.base(req_buf));
+            state = RequestParseState::HEADER_VALUE;
+            break;
+        }
+    }
+
+    return value_stop;
+}
+
+void HttpParser::add_header(HttpRequestView& request)
+{
+    auto& header = request.headers[request.num_headers];
+    header.value = Slice{token_start, value_end - token_start};
+
+    request.num_headers++;
+    if (header.id != HeaderId::OTHER && !request.header_index[(size_t) header.id]) {
+        request.header_index[(size_t) header.id] = (uint8_t) request.num_headers;
+    }
 }
 
 HttpParser::RequestParseState HttpParser::parse_uri_char(char ch)
@@ -268,7 +350,7 @@ HttpParser::RequestParseState HttpParser::parse_uri_char(char ch)
 
         break;
     case RequestParseState::PATH:
-        if (is_uri_char(ch)) {
+        if (HttpTokenizer::is_path_char(ch)) {
             return state;
         }
 
@@ -276,6 +358,8 @@ HttpParser::RequestParseState HttpParser::parse_uri_char(char ch)
             return RequestParseState::QUERY_STRING_START;
         }
         break;
+    default:
+        break;
     }
 
     return RequestParseState::FINISH;
@@ -0,0 +1,78 @@
+#include "http_request.h"
+
+#include <strings.h>
+#include <cstring>
+
+HttpMethod lookup_http_method(const void* name, size_t len)
+{
+    for (size_t i = (size_t) HttpMethod::GET; i < (size_t) HttpMethod::COUNT; ++i) {
+        auto method = (HttpMethod) i;
+        auto method_name = http_method_name(method);
+        if (std::strlen(method_name) == len && std::memcmp(method_name, name, len) == 0) {
+            return method;
+        }
+    }
+
+    return HttpMethod::UNKNOWN;
+}
+
+const HttpRequestView::Header* HttpRequestView::find_header(const ByteBuffer& buf, const char* name, size_t name_len) const
+{
+    auto id = lookup_header_id(name, name_len);
+    if (id != HeaderId::OTHER) {
+        return find_header(id);
+    }
+
+    auto p = base(buf);
+
+    for (size_t i = 0; i < num_headers; ++i) {
+        auto& header = headers[i];
+        if (header.name.length == name_len &&
+            strncasecmp(reinterpret_cast<const char*>(p + header.name.offset), name, name_len) == 0) {
+            return &header;
+        }
+    }
+
+    return nullptr;
+}
+
+bool HttpRequestView::header_has_token(const ByteBuffer& buf, const Header* header, const char* token, size_t token_len) const
+{
+    auto p = reinterpret_cast<const char*>(base(buf) + header->value.offset);
+    auto end = p + header->value.length;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+
+        auto item = p;
+        while (p < end && *p != ',') ++p;
+
+        auto item_end = p;
+        while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t')) --item_end;
+
+        if ((size_t) (item_end - item) == token_len && strncasecmp(item, token, token_len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void HttpRequestView::materialize(const ByteBuffer& buf, HttpRequest& request) const
+{
+    auto p = base(buf);
+
+    request.method = method;
+    request.uri.clear();
+    request.uri.append(p + uri.offset, uri.length);
+    request.query_string.clear();
+    request.query_string.append(p + query_string.offset, query_string.length);
+    request.http_major = http_major;
+    request.http_minor = http_minor;
+
+    request.headers.clear();
+    for (size_t i = 0; i < num_headers; ++i) {
+        auto& header = headers[i];
+        request.headers.set(header.id, p + header.name.offset, header.name.length, p + header.value.offset, header.value.length);
+    }
+}
@@ -1,161 +1,284 @@
 #include "http_server.h"
 #include "http_connection.h"
+#include "reactor.h"
+#include "static_files.h"
 #include "easylogging++.h"
 
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <netdb.h>
-#include <sys/epoll.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <atomic>
 #include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <stdexcept>
 
 HttpServer::HttpServer(const std::string& host, Port port, ScriptInterface* script_interface, int ncpus, int backlog)
-    : host(host), port(port), script_interface(script_interface), backlog(backlog), thread_pool(ncpus)
+    : host(host), port(port), script_interface(script_interface), backlog(backlog), thread_pool(ncpus),
+      nreactors(1), pin_cpus(false), max_connections(MAX_CONNECTIONS), batch_size(1),
+      max_body_size(DEFAULT_MAX_BODY_SIZE), body_buffer_size(RequestBody::DEFAULT_MEMORY_LIMIT),
+      io_backend(IoBackend::Type::EPOLL)
 {
     script_interface->load_script(this);
+    url_map.compile();
 }
 
-void HttpServer::start_main_loop()
+void HttpServer::set_reactors(int nreactors, bool pin_cpus)
 {
-    int listen_fd = open_listenfd();
-    if (listen_fd == -1) {
-        throw std::runtime_error("cannot open listen socket");
+    if (nreactors < 1) {
+        throw std::invalid_argument("at least one reactor is required");
     }
 
-    if (make_socket_non_blocking(listen_fd) == -1) {
-        throw std::runtime_error("failed to make socket non-blocking");
-    }
+    this->nreactors = nreactors;
+    this->pin_cpus = pin_cpus;
+}
 
-    int epfd;
-    epfd = epoll_create1(EPOLL_FLAGS);
-    if (epfd == -1) {
-        throw std::runtime_error("failed to create epoll");
+void HttpServer::set_max_connections(size_t max_connections)
+{
+    if (max_connections < 1) {
+        throw std::invalid_argument("at least one connection must be allowed");
     }
 
-    auto http_conn = new HttpConnection(this, epfd, listen_fd);
+    this->max_connections = max_connections;
+}
 
-    struct epoll_event ep_event;
-    ep_event.events = EPOLLIN | EPOLLET;
-    ep_event.data.ptr = reinterpret_cast<void*>(http_conn);
-    epoll_add(epfd, listen_fd, &ep_event);
+void HttpServer::set_batch_size(size_t batch_size)
+{
+    if (batch_size < 1) {
+        throw std::invalid_argument("a batch holds at least one request");
+    }
 
-    LOG(INFO) << "Running on http://" << host << ":" << port << "/";
+    this->batch_size = batch_size;
+}
 
-    auto events = std::make_unique<struct epoll_event[]>(MAX_EVENTS);
+void HttpServer::set_listen_fds(const std::vector<int>& listen_fds)
+{
+    if (!listen_fds.empty() && (int) listen_fds.size() != nreactors) {
+        throw std::invalid_argument("one listen socket is required for each reactor");
+    }
 
-    while(true) {
-        int nready = epoll_wait(epfd, events.get(), MAX_EVENTS, -1);
+    this->listen_fds = listen_fds;
+}
 
-        if (nready < 0) {
-            if (errno == EINTR) {
-                continue;
-            } else {
-                throw std::runtime_error("epoll_wait failed");
-            }
+void HttpServer::start_main_loop()
+{
+    /* reactors are pinned to the cores the process may run on, a worker process may have been given only one */
+    std::vector<int> cpus;
+    cpu_set_t cpuset;
+    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpuset)) cpus.push_back(cpu);
         }
+    }
+    if (cpus.empty()) cpus.push_back(0);
 
-        for (int i = 0; i < nready; ++i) {
-            auto conn = reinterpret_cast<HttpConnection*>(events[i].data.ptr);
-            int fd = conn->get_fd();
+    size_t reactor_connections = (max_connections + nreactors - 1) / nreactors;
 
-            if (listen_fd == fd) {
-                /* handle incoming connections */
-                socklen_t clientlen;
-                struct sockaddr_in clientaddr;
+    std::vector<std::unique_ptr<Reactor> > reactors;
+    for (int i = 0; i < nreactors; ++i) {
+        int cpu = pin_cpus ? cpus[i % cpus.size()] : -1;
+        int listen_fd = listen_fds.empty() ? -1 : listen_fds[i];
+        reactors.emplace_back(std::make_unique<Reactor>(this, i, reactor_connections, cpu, listen_fd));
+    }
 
-                clientlen = sizeof(clientaddr);
-                int conn_fd = accept(listen_fd, reinterpret_cast<struct sockaddr*>(&clientaddr), &clientlen);
-                if (conn_fd < 0) {
-                    throw std::runtime_error("accept error");
-                }
+    LOG(INFO) << "Running on http://" << host << ":" << port << "/ with " << nreactors << " reactor(s)";
 
-                LOG(DEBUG) << "Accepting new connection, fd = " << conn_fd;
-                if (make_socket_non_blocking(conn_fd) == -1) {
-                    throw std::runtime_error("failed to make socket non-blocking");
-                }
+    /* reactor 0 runs on the calling thread */
+    std::vector<std::thread> reactor_threads;
+    for (int i = 1; i < nreactors; ++i) {
+        reactor_threads.emplace_back([&reactors, i]() {
+            reactors[i]->run();
+        });
+    }
 
-                auto new_conn = new HttpConnection(this, epfd, conn_fd);
-                struct epoll_event new_event;
-                new_event.events = EPOLLIN | EPOLLOUT | EPOLLET;
-                new_event.data.ptr = reinterpret_cast<void*>(new_conn);
-                epoll_add(epfd, conn_fd, &new_event);
-            } else {
-                if (events[i].events & EPOLLIN) {
-                    conn->handle_read_event();
-                } else {
-                    conn->handle_write_event();
-                }
-            }
-        }
+    reactors[0]->run();
+
+    for (auto& thread : reactor_threads) {
+        thread.join();
     }
 }
 
-int HttpServer::open_listenfd()
+void HttpServer::register_url_rule(const ByteBuffer& rule, const UrlMap::Route& route, const std::vector<HttpMethod>& methods)
 {
-    int sfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if(sfd == -1) {
-        return -1;
+    url_map.register_rule(rule, route, methods);
+}
+
+void HttpServer::register_static(const ByteBuffer& prefix, const std::string& directory)
+{
+    struct stat st;
+    if (stat(directory.c_str(), &st) == -1 || !S_ISDIR(st.st_mode)) {
+        throw FileIOError("static directory " + directory + " is not a directory");
     }
 
-    int opt = 1;
-    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    auto files = std::make_shared<StaticFiles>(directory, &file_cache);
+    url_map.register_mount(prefix, [files](const HttpRequest& request, const uint8_t* path, size_t path_len) {
+        return files->serve(request, path, path_len);
+    }, { HttpMethod::GET });
 
-    struct sockaddr_in sa;
-    std::memset(&sa, 0, sizeof(sa));
-    sa.sin_family = AF_INET;
-    sa.sin_port = htons(port);
-    sa.sin_addr.s_addr = inet_addr(host.c_str());
-    if (bind(sfd, (struct sockaddr*)&sa, sizeof(struct sockaddr)) == -1) {
-        return -1;
-    }
+    LOG(INFO) << "Serving " << directory << " under " << prefix;
+}
 
-    if (listen(sfd, backlog) == -1) {
-        close(sfd);
-        return -1;
-    }
+/* the request line and the values of the headers the route varies on */
+static void build_cache_key(const HttpRequest& request, const UrlMap::CachePolicy& cache, ByteBuffer& key)
+{
+    auto method = http_method_name(request.method);
+    key.append(method, std::strlen(method));
+    key.append(" ", 1);
+    key.append(request.uri);
+    key.append("?", 1);
+    key.append(request.query_string);
 
-    return sfd;
+    for (auto& name : cache.vary) {
+        auto value = request.headers.get(name);
+        /* an absent header and an empty one are different keys */
+        if (value) {
+            key.append("\n=", 2);
+            key.append(*value);
+        } else {
+            key.append("\n", 1);
+        }
+    }
 }
 
-int HttpServer::make_socket_non_blocking(int sfd)
+void HttpServer::dispatch_request(const HttpRequest& request, Arena& arena, RequestCallback&& callback)
 {
-    int flags = fcntl (sfd, F_GETFL, 0);
-    if (flags == -1) {
-        return -1;
+    size_t prefix_len;
+    auto mount = url_map.match_mount(request.uri, request.method, prefix_len);
+    if (mount) {
+        /* mounts are native and answered right here on the reactor, at most after a few metadata calls
+         * on the file system (open, fstat and a stat to revalidate a cached file) */
+        HttpResponse response;
+        try {
+            response = (*mount)(request, request.uri.data() + prefix_len, request.uri.size() - prefix_len);
+        } catch (...) {
+            response = HttpConnection::make_error_response(500);
+        }
+
+        callback(std::move(response));
+        return;
     }
-    if(fcntl (sfd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        return -1;
+
+    /* the captures live next to the request, so the task only carries pointers */
+    auto params = arena.create<UrlMap::UrlParams>();
+    auto route = url_map.match_url(request.uri, request.method, *params);
+    if (!route) {
+        callback(HttpConnection::make_error_response(404));
+        return;
+    }
+
+    ByteBuffer* cache_key = nullptr;
+    uint64_t cache_hash = 0;
+    /* other methods have side effects, or a body the key does not cover, their handler always runs */
+    bool cacheable = request.method == HttpMethod::GET || request.method == HttpMethod::HEAD;
+    if (route->cache.enabled() && cacheable) {
+        cache_key = arena.create<ByteBuffer>(&arena);
+        build_cache_key(request, route->cache, *cache_key);
+        cache_hash = hash_bytes(cache_key->data(), cache_key->size());
+
+        auto cached = response_cache.get(*cache_key, cache_hash);
+        if (cached) {
+            /* a hit is answered right here, neither a worker nor the interpreter is involved */
+            HttpResponse response;
+            response.status_code = cached->status_code;
+            response.serialized = std::move(cached);
+
+            callback(std::move(response));
+            return;
+        }
+    }
+
+    auto& batch = current_batch();
+    batch.push_back(HandlerCall{route, &request, params, cache_key, cache_hash, std::move(callback), HttpResponse()});
+    if (batch.size() >= batch_size) {
+        flush_dispatch();
     }
-    return 0;
 }
 
-int HttpServer::epoll_add(int epfd, int fd, struct epoll_event* event)
+HttpServer::CallBatch& HttpServer::current_batch()
 {
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, event) == -1) {
-        throw std::runtime_error("cannot add epoll event");
-    }
+    /* only the reactor running on this thread adds to it */
+    static thread_local CallBatch batch;
+    return batch;
 }
 
-void
-HttpServer::register_url_rule(const ByteBuffer& rule, UrlMap::RequestHandler&& handler, const std::vector<HttpMethod>& methods)
+void HttpServer::flush_dispatch()
 {
-    url_map.register_rule(rule, std::move(handler), methods);
+    auto& batch = current_batch();
+    if (batch.empty()) return;
+
+    thread_pool.push([this, calls = std::move(batch)](int) mutable {
+        run_calls(calls);
+    });
+    batch.clear();
 }
 
-void HttpServer::dispatch_request(HttpConnection& conn, HttpRequest request, RequestCallback&& callback)
+void HttpServer::run_on_worker(std::function<void()>&& task)
 {
-    UrlMap::UrlPatternMap pattern_map;
-    auto handler = url_map.match_url(request.uri, request.method, pattern_map);
+    thread_pool.push([task = std::move(task)](int) {
+        task();
+    });
+}
 
-    thread_pool.push([handler, &conn, request = std::move(request), callback = std::move(callback), pattern_map = std::move(pattern_map)](int){
-        try {
-            auto resp = handler(request, pattern_map);
-            callback(resp);
-        } catch (...) {
-            conn.handle_internal_error();
+void HttpServer::run_calls(CallBatch& calls)
+{
+    /* the handlers run back to back, an interpreter with a global lock takes it once for all of them */
+    script_interface->run_batch([this, &calls]() {
+        for (auto& call : calls) {
+            auto route = call.route;
+
+            try {
+                if (route->async_handler) {
+                    start_async_call(call);
+                } else {
+                    call.response = route->handler(*call.request, *call.params);
+                }
+            } catch (...) {
+                call.response = HttpConnection::make_error_response(500);
+            }
         }
     });
+
+    for (auto& call : calls) {
+        /* an async call has taken the callback over, it answers through it even when it fails */
+        if (!call.callback) continue;
+
+        cache_response(call.route, call.cache_key, call.cache_hash, call.response);
+        call.callback(std::move(call.response));
+    }
+}
+
+void HttpServer::start_async_call(HandlerCall& call)
+{
+    auto route = call.route;
+
+    /* The callback is taken over before the handler is called. The handler may have handed its copy on
+     * by the time it fails, so only the first of the answers goes through. */
+    auto answered = std::make_shared<std::atomic<bool>>(false);
+    RequestCallback callback([this, route, cache_key = call.cache_key, cache_hash = call.cache_hash, answered,
+                              callback = std::move(call.callback)](HttpResponse&& response) {
+        if (answered->exchange(true)) return;
+
+        /* the response is cached when it arrives, on whichever thread completes it */
+        cache_response(route, cache_key, cache_hash, response);
+        callback(std::move(response));
+    });
+    call.callback = nullptr;
+
+    RequestCallback handler_callback(callback);
+    try {
+        route->async_handler(*call.request, *call.params, handler_callback);
+    } catch (...) {
+        callback(HttpConnection::make_error_response(500));
+    }
+}
+
+void HttpServer::cache_response(const UrlMap::Route* route, ByteBuffer* cache_key, uint64_t cache_hash,
+                                HttpResponse& response)
+{
+    if (!cache_key || response.status_code != 200) return;
+
+    response.serialized = HttpConnection::serialize_response(response);
+    if (response.serialized) {
+        response_cache.put(*cache_key, cache_hash, response.serialized, route->cache.ttl);
+    }
 }
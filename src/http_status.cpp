@@ -0,0 +1,134 @@
+#include "http_status.h"
+#include "http_date.h"
+
+#include <cstring>
+#include <ctime>
+#include <string>
+
+static const int MIN_STATUS_CODE = 100;
+static const int MAX_STATUS_CODE = 599;
+
+static const char STATUS_LINE_PREFIX[] = "HTTP/1.1 ";
+static const char STATUS_LINE_SUFFIX[] = "\r\nServer: Porgi\r\n";
+
+const char* http_reason_phrase(int status_code)
+{
+    switch (status_code) {
+    case 100: return "Continue";
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 203: return "Non-Authoritative Information";
+    case 204: return "No Content";
+    case 205: return "Reset Content";
+    case 206: return "Partial Content";
+    case 300: return "Multiple Choices";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 402: return "Payment Required";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 406: return "Not Acceptable";
+    case 407: return "Proxy Authentication Required";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 410: return "Gone";
+    case 411: return "Length Required";
+    case 412: return "Precondition Failed";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 415: return "Unsupported Media Type";
+    case 416: return "Range Not Satisfiable";
+    case 417: return "Expectation Failed";
+    case 421: return "Misdirected Request";
+    case 422: return "Unprocessable Entity";
+    case 426: return "Upgrade Required";
+    case 428: return "Precondition Required";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 451: return "Unavailable For Legal Reasons";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    case 505: return "HTTP Version Not Supported";
+    case 511: return "Network Authentication Required";
+    default: return "";
+    }
+}
+
+namespace {
+
+class StatusLineTable {
+public:
+    StatusLineTable()
+    {
+        for (int code = MIN_STATUS_CODE; code <= MAX_STATUS_CODE; ++code) {
+            std::string line(STATUS_LINE_PREFIX);
+            line += std::to_string(code);
+            line += ' ';
+            line += http_reason_phrase(code);
+            line += STATUS_LINE_SUFFIX;
+
+            lines[code - MIN_STATUS_CODE] = ByteBuffer(line);
+        }
+    }
+
+    const ByteBuffer& get(int status_code) const { return lines[status_code - MIN_STATUS_CODE]; }
+
+private:
+    ByteBuffer lines[MAX_STATUS_CODE - MIN_STATUS_CODE + 1];
+};
+
+}
+
+/* built before main, the table is never written afterwards */
+static const StatusLineTable status_lines;
+
+void append_status_line(int status_code, ByteBuffer& buf)
+{
+    if (status_code >= MIN_STATUS_CODE && status_code <= MAX_STATUS_CODE) {
+        buf.append(status_lines.get(status_code));
+        return;
+    }
+
+    /* not a valid code, but sent the way the application gave it */
+    buf.append(STATUS_LINE_PREFIX, sizeof(STATUS_LINE_PREFIX) - 1);
+    if (status_code < 0) {
+        buf.append("-", 1);
+        buf.append_decimal((uint64_t) -(int64_t) status_code);
+    } else {
+        buf.append_decimal((uint64_t) status_code);
+    }
+    buf.append(" ", 1);
+    buf.append(STATUS_LINE_SUFFIX, sizeof(STATUS_LINE_SUFFIX) - 1);
+}
+
+const std::shared_ptr<const ByteBuffer>& current_date_header()
+{
+    static thread_local time_t last_update = -1;
+    static thread_local std::shared_ptr<const ByteBuffer> header;
+
+    time_t now = time(nullptr);
+    if (now != last_update) {
+        char line[6 + HTTP_DATE_LENGTH + 2];
+        std::memcpy(line, "Date: ", 6);
+        format_http_date(now, line + 6);
+        std::memcpy(line + 6 + HTTP_DATE_LENGTH, "\r\n", 2);
+
+        /* responses still queued keep the previous second's header alive */
+        header = std::make_shared<const ByteBuffer>(line, sizeof(line));
+        last_update = now;
+    }
+
+    return header;
+}
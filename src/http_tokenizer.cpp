@@ -0,0 +1,188 @@
+#include "http_tokenizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PORGI_TOKENIZER_X86
+#include <immintrin.h>
+#endif
+
+/* pchar and '/' from RFC 3986 */
+const bool HttpTokenizer::path_chars[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* path characters and '?' */
+const bool HttpTokenizer::query_chars[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* tchar from RFC 7230 */
+const bool HttpTokenizer::token_chars[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* field-vchar, SP and HTAB */
+const bool HttpTokenizer::value_chars[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+const HttpTokenizer::Implementation HttpTokenizer::impl = HttpTokenizer::select_implementation();
+
+template <bool (*is_char)(uint8_t)>
+static const uint8_t* scan_scalar(const uint8_t* p, const uint8_t* end)
+{
+    while (p != end && is_char(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+#ifdef PORGI_TOKENIZER_X86
+
+/* Byte ranges (as inclusive pairs) that stop a scan. A range may also cover a few characters that are
+ * in the class, those are rechecked against the lookup table and the scan goes on. */
+alignas(16) static const char path_ranges[17] = "\x00\x20\"#<<>?[^``{}\x7f\xff";
+alignas(16) static const char query_ranges[17] = "\x00\x20\"#<<>>[^``{}\x7f\xff";
+alignas(16) static const char token_ranges[17] = "\x00\x20\"\"()\x2c\x2c//:@[]{\xff";
+alignas(16) static const char value_ranges[17] = "\x00\x08\x0a\x1f\x7f\x7f";
+
+template <const char* ranges, int ranges_len, bool (*is_char)(uint8_t)>
+__attribute__((target("sse4.2")))
+static const uint8_t* scan_sse42(const uint8_t* p, const uint8_t* end)
+{
+    __m128i ranges16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+
+    while (end - p >= 16) {
+        __m128i b16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int idx = _mm_cmpestri(ranges16, ranges_len, b16, 16,
+                               _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+        if (idx == 16) {
+            p += 16;
+            continue;
+        }
+
+        p += idx;
+        if (!is_char(*p)) {
+            return p;
+        }
+        ++p;
+    }
+
+    return scan_scalar<is_char>(p, end);
+}
+
+/* 32 bytes at a time: a header value ends at the first control character other than HTAB */
+__attribute__((target("avx2")))
+static const uint8_t* scan_value_avx2(const uint8_t* p, const uint8_t* end)
+{
+    const __m256i ctl_max = _mm256_set1_epi8(0x1f);
+    const __m256i htab = _mm256_set1_epi8(0x09);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+
+    while (end - p >= 32) {
+        __m256i b32 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(b32, ctl_max), b32);
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(b32, htab), ctl);
+        ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(b32, del));
+
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(ctl);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    return scan_scalar<HttpTokenizer::is_value_char>(p, end);
+}
+
+#endif
+
+HttpTokenizer::Implementation HttpTokenizer::select_implementation()
+{
+#ifdef PORGI_TOKENIZER_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.2")) {
+        Implementation sse42 {
+            "sse4.2",
+            scan_sse42<path_ranges, 16, is_path_char>,
+            scan_sse42<query_ranges, 16, is_query_char>,
+            scan_sse42<token_ranges, 16, is_token_char>,
+            scan_sse42<value_ranges, 6, is_value_char>,
+        };
+
+        if (__builtin_cpu_supports("avx2")) {
+            sse42.name = "avx2";
+            sse42.scan_value = scan_value_avx2;
+        }
+
+        return sse42;
+    }
+#endif
+
+    return Implementation {
+        "scalar",
+        scan_scalar<is_path_char>,
+        scan_scalar<is_query_char>,
+        scan_scalar<is_token_char>,
+        scan_scalar<is_value_char>,
+    };
+}
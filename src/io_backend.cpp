@@ -0,0 +1,33 @@
+#include "io_backend.h"
+#include "epoll_backend.h"
+#include "uring_backend.h"
+#include "easylogging++.h"
+
+bool IoBackend::parse_type(const std::string& name, Type& type)
+{
+    if (name == "epoll") {
+        type = Type::EPOLL;
+        return true;
+    }
+    if (name == "uring" || name == "io_uring") {
+        type = Type::URING;
+        return true;
+    }
+
+    return false;
+}
+
+std::unique_ptr<IoBackend> IoBackend::create(Type type, Reactor* reactor, int listen_fd, bool shared_listen_fd,
+                                             CompletionQueue* completions)
+{
+    if (type == Type::URING) {
+        try {
+            return std::make_unique<UringBackend>(reactor, listen_fd, completions);
+        } catch (const UringBackend::Unavailable& e) {
+            /* older kernels, or io_uring turned off by the administrator */
+            LOG(WARNING) << "io_uring is not available: " << e.what() << ", falling back to epoll";
+        }
+    }
+
+    return std::make_unique<EpollBackend>(reactor, listen_fd, shared_listen_fd, completions);
+}
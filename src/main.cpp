@@ -1,13 +1,28 @@
 #include "http_server.h"
 #include "python_script_interface.h"
+#include "reactor.h"
+#include "supervisor.h"
 
 #include "cxxopts/include/cxxopts.hpp"
 #include "easylogging++.h"
 INITIALIZE_EASYLOGGINGPP
 
+static const char HOST[] = "127.0.0.1";
+
 uint16_t port;
 std::string script_path;
 int ncpus;
+int nreactors;
+bool pin_reactors;
+size_t max_connections;
+size_t cache_size;
+size_t batch_size;
+int nworkers;
+bool pin_workers;
+size_t max_body_size;
+size_t body_buffer_size;
+std::string io_backend_name;
+IoBackend::Type io_backend;
 
 static void print_help(const char* program)
 {
@@ -15,6 +30,21 @@ static void print_help(const char* program)
     std::cerr << "Options:" << std::endl;
     std::cerr << "\t-p,--port <port>    The port that Porgi listens on. Default is 8080" << std::endl;
     std::cerr << "\t-n,--ncpus <ncpus>  Number of worker threads. Default is 1" << std::endl;
+    std::cerr << "\t-r,--reactors <n>   Number of event loops accepting connections. Default is 1" << std::endl;
+    std::cerr << "\t--pin-reactors      Pin each event loop to its own CPU core" << std::endl;
+    std::cerr << "\t-c,--max-connections <n>" << std::endl;
+    std::cerr << "\t                    Number of open connections before new ones are turned away. Default is 1024" << std::endl;
+    std::cerr << "\t--cache-size <MiB>  Memory for responses of routes with cache_ttl. Default is 64" << std::endl;
+    std::cerr << "\t-b,--batch <n>      Number of requests a worker takes from an event loop at once. Default is 1" << std::endl;
+    std::cerr << "\t-w,--workers <n>    Number of worker processes, each with its own interpreter. Default is 0," << std::endl;
+    std::cerr << "\t                    which serves from this process" << std::endl;
+    std::cerr << "\t--pin-workers       Pin each worker process to its own CPU core" << std::endl;
+    std::cerr << "\t--max-body-size <MiB>" << std::endl;
+    std::cerr << "\t                    Largest request body accepted, larger ones get 413. Default is 16" << std::endl;
+    std::cerr << "\t--body-buffer-size <KiB>" << std::endl;
+    std::cerr << "\t                    Memory for each request body, the rest goes to a temporary file. Default is 64" << std::endl;
+    std::cerr << "\t--io-backend <epoll|uring>" << std::endl;
+    std::cerr << "\t                    How the event loops do their I/O. Default is epoll" << std::endl;
     std::cerr << "\t-h,--help           Print this help information" << std::endl;
 
     exit(1);
@@ -27,12 +57,22 @@ static void parse_arg(int argc, char* argv[])
     options.add_options()
         ("p,port", "", cxxopts::value<uint16_t>(port)->default_value("8080"), "PORT")
         ("n,ncpus", "", cxxopts::value<int>(ncpus)->default_value("1"), "NCPUS")
+        ("r,reactors", "", cxxopts::value<int>(nreactors)->default_value("1"), "REACTORS")
+        ("pin-reactors", "", cxxopts::value<bool>(pin_reactors))
+        ("c,max-connections", "", cxxopts::value<size_t>(max_connections)->default_value("1024"), "MAX_CONNECTIONS")
+        ("cache-size", "", cxxopts::value<size_t>(cache_size)->default_value("64"), "MIB")
+        ("b,batch", "", cxxopts::value<size_t>(batch_size)->default_value("1"), "BATCH")
+        ("w,workers", "", cxxopts::value<int>(nworkers)->default_value("0"), "WORKERS")
+        ("pin-workers", "", cxxopts::value<bool>(pin_workers))
+        ("max-body-size", "", cxxopts::value<size_t>(max_body_size)->default_value("16"), "MIB")
+        ("body-buffer-size", "", cxxopts::value<size_t>(body_buffer_size)->default_value("64"), "KIB")
+        ("io-backend", "", cxxopts::value<std::string>(io_backend_name)->default_value("epoll"), "BACKEND")
         ("script", "", cxxopts::value<std::string>(script_path), "SCRIPT");
 
     options.parse_positional({"script"});
     auto result = options.parse(argc, argv);
 
-    if (result.count("script") != 1) {
+    if (result.count("script") != 1 || !IoBackend::parse_type(io_backend_name, io_backend)) {
         print_help(argv[0]);
     }
 }
@@ -50,15 +90,44 @@ ScriptInterface* get_script_interface(const std::string& script_path)
     }
 }
 
-int main(int argc, char** argv)
+static int serve(const std::vector<int>& listen_fds)
 {
-    parse_arg(argc, argv);
-
     ScriptInterface* script_interface = get_script_interface(script_path);
 
-    HttpServer server("127.0.0.1", port, script_interface, ncpus);
+    HttpServer server(HOST, port, script_interface, ncpus);
+    server.set_reactors(nreactors, pin_reactors);
+    server.set_listen_fds(listen_fds);
+    server.set_max_connections(max_connections);
+    server.set_response_cache_size(cache_size << 20);
+    server.set_batch_size(batch_size);
+    server.set_max_body_size(max_body_size << 20);
+    server.set_body_buffer_size(body_buffer_size << 10);
+    server.set_io_backend(io_backend);
     server.start_main_loop();
 
     return 0;
 }
 
+int main(int argc, char** argv)
+{
+    parse_arg(argc, argv);
+
+    if (nworkers == 0) {
+        return serve(std::vector<int>());
+    }
+
+    /* opened before forking, the workers accept from the same sockets */
+    std::vector<int> listen_fds;
+    for (int i = 0; i < nreactors; ++i) {
+        int listen_fd = Reactor::open_listenfd(HOST, port, HttpServer::DEFAULT_BACKLOG);
+        if (listen_fd == -1) {
+            throw std::runtime_error("cannot open listen socket");
+        }
+        listen_fds.push_back(listen_fd);
+    }
+
+    Supervisor supervisor(nworkers, pin_workers);
+    return supervisor.run([&listen_fds](int) {
+        return serve(listen_fds);
+    });
+}
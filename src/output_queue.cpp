@@ -0,0 +1,204 @@
+#include "output_queue.h"
+
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <utility>
+
+const uint8_t* OutputQueue::Segment::data() const
+{
+    switch (type) {
+    case SegmentType::OWNED:
+        return owned.data() + offset;
+    case SegmentType::SHARED:
+    case SegmentType::STATIC:
+        return static_data + offset;
+    default:
+        return nullptr;
+    }
+}
+
+void OutputQueue::append(ByteBuffer&& buf)
+{
+    if (buf.size() == 0) return;
+
+    segments.emplace_back();
+    auto& segment = segments.back();
+    segment.type = SegmentType::OWNED;
+    segment.size = buf.size();
+    segment.owned = std::move(buf);
+    segment.static_data = nullptr;
+    segment.offset = 0;
+
+    nbytes += segment.size;
+}
+
+void OutputQueue::append(std::shared_ptr<const ByteBuffer> buf)
+{
+    if (!buf) return;
+
+    const uint8_t* data = buf->data();
+    size_t size = buf->size();
+    append_shared(std::move(buf), data, size);
+}
+
+void OutputQueue::append_shared(std::shared_ptr<const void> owner, const void* data, size_t size)
+{
+    if (!owner || size == 0) return;
+
+    segments.emplace_back();
+    auto& segment = segments.back();
+    segment.type = SegmentType::SHARED;
+    segment.size = size;
+    segment.shared = std::move(owner);
+    segment.static_data = static_cast<const uint8_t*>(data);
+    segment.offset = 0;
+
+    nbytes += segment.size;
+}
+
+void OutputQueue::append_static(const void* data, size_t size)
+{
+    if (size == 0) return;
+
+    segments.emplace_back();
+    auto& segment = segments.back();
+    segment.type = SegmentType::STATIC;
+    segment.static_data = static_cast<const uint8_t*>(data);
+    segment.offset = 0;
+    segment.size = size;
+
+    nbytes += size;
+}
+
+void OutputQueue::append_file(std::shared_ptr<const OpenFile> file, size_t offset, size_t length)
+{
+    if (!file || length == 0) return;
+
+    segments.emplace_back();
+    auto& segment = segments.back();
+    segment.type = SegmentType::FILE;
+    segment.file = std::move(file);
+    segment.static_data = nullptr;
+    segment.file_offset = offset;
+    segment.offset = 0;
+    segment.size = length;
+
+    nbytes += length;
+    nfiles++;
+}
+
+void OutputQueue::splice(OutputQueue& other)
+{
+    if (segments.empty()) {
+        segments.swap(other.segments);
+    } else {
+        for (auto& segment : other.segments) {
+            segments.emplace_back(std::move(segment));
+        }
+        other.segments.clear();
+    }
+
+    nbytes += other.nbytes;
+    nfiles += other.nfiles;
+    other.nbytes = 0;
+    other.nfiles = 0;
+}
+
+ssize_t OutputQueue::flush(int fd)
+{
+    ssize_t total = 0;
+
+    while (!segments.empty()) {
+        ssize_t nwritten;
+        if (segments.front().type == SegmentType::FILE) {
+            nwritten = send_file(fd);
+        } else {
+            nwritten = write_buffers(fd);
+        }
+
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+
+        consume((size_t) nwritten);
+        total += nwritten;
+    }
+
+    return total;
+}
+
+ssize_t OutputQueue::send_file(int fd)
+{
+    auto& front = segments.front();
+    off_t pos = (off_t) (front.file_offset + front.offset);
+
+    ssize_t nwritten = sendfile(fd, front.file->fd, &pos, front.remaining());
+    if (nwritten == 0) {
+        /* the file has been truncated under us, the response can no longer be completed */
+        errno = EIO;
+        return -1;
+    }
+
+    return nwritten;
+}
+
+ssize_t OutputQueue::write_buffers(int fd)
+{
+    struct iovec iov[MAX_IOVECS];
+    size_t nbytes;
+
+    int iovcnt = gather(iov, nbytes);
+    return writev(fd, iov, iovcnt);
+}
+
+int OutputQueue::gather(struct iovec* iov, size_t& nbytes) const
+{
+    nbytes = 0;
+
+    /* gather up to the next file region */
+    int iovcnt = 0;
+    for (auto it = segments.begin(); it != segments.end() && iovcnt < (int) MAX_IOVECS; ++it) {
+        if (it->type == SegmentType::FILE) break;
+
+        iov[iovcnt].iov_base = const_cast<uint8_t*>(it->data());
+        iov[iovcnt].iov_len = it->remaining();
+        nbytes += it->remaining();
+        iovcnt++;
+    }
+
+    return iovcnt;
+}
+
+void OutputQueue::consume(size_t count)
+{
+    nbytes -= count;
+
+    while (count > 0) {
+        auto& front = segments.front();
+        size_t n = front.remaining();
+
+        if (count < n) {
+            front.offset += count;
+            return;
+        }
+
+        count -= n;
+        if (front.type == SegmentType::FILE) {
+            nfiles--;
+        }
+        segments.pop_front();
+    }
+}
+
+void OutputQueue::clear()
+{
+    segments.clear();
+    nbytes = 0;
+    nfiles = 0;
+}
@@ -0,0 +1,479 @@
+#include "python_request.h"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace {
+
+struct RequestObject {
+    PyObject_HEAD
+    /* nullptr once the request has been answered */
+    const HttpRequest* request;
+    PyObject* uri;
+    PyObject* query_string;
+    /* how far the body has been read */
+    size_t body_position;
+};
+
+/* a view of the request's headers, it keeps the request object alive */
+struct HeadersObject {
+    PyObject_HEAD
+    RequestObject* owner;
+};
+
+/* a file-like reader of the request body, the position is the request's so that every reader shares it */
+struct BodyObject {
+    PyObject_HEAD
+    RequestObject* owner;
+};
+
+PyObject* method_names[(size_t) HttpMethod::COUNT];
+PyObject* header_names[(size_t) HeaderId::COUNT];
+
+PyTypeObject RequestType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+PyTypeObject HeadersType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+PyTypeObject BodyType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+PyObject* to_str(const ByteBuffer& buf)
+{
+    /* like the bytes themselves, anything that is not UTF-8 survives a round trip */
+    return PyUnicode_DecodeUTF8(reinterpret_cast<const char*>(buf.data()), (Py_ssize_t) buf.size(), "surrogateescape");
+}
+
+bool check_valid(RequestObject* self)
+{
+    if (!self->request) {
+        PyErr_SetString(PyExc_RuntimeError, "the request has already been answered");
+        return false;
+    }
+    return true;
+}
+
+/* a copy, the request's memory is reused for other requests once this one has been answered */
+PyObject* to_bytes(const ByteBuffer& buf)
+{
+    return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(buf.data()), (Py_ssize_t) buf.size());
+}
+
+/* header names are looked up case-insensitively, only str keys can match */
+const ByteBuffer* find_header(RequestObject* owner, PyObject* key)
+{
+    if (!check_valid(owner)) return nullptr;
+
+    if (!PyUnicode_Check(key)) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return nullptr;
+    }
+
+    Py_ssize_t len;
+    const char* name = PyUnicode_AsUTF8AndSize(key, &len);
+    if (!name) return nullptr;
+
+    auto value = owner->request->headers.get(name, (size_t) len);
+    if (!value) {
+        PyErr_SetObject(PyExc_KeyError, key);
+    }
+    return value;
+}
+
+PyObject* header_name(const HeaderMap::Entry& entry)
+{
+    if (entry.id != HeaderId::OTHER) {
+        auto name = header_names[(size_t) entry.id];
+        Py_INCREF(name);
+        return name;
+    }
+
+    return to_str(entry.name);
+}
+
+/* HttpRequest */
+
+void request_dealloc(RequestObject* self)
+{
+    Py_XDECREF(self->uri);
+    Py_XDECREF(self->query_string);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+PyObject* request_get_uri(RequestObject* self, void*)
+{
+    if (!self->uri) {
+        if (!check_valid(self)) return nullptr;
+        self->uri = to_str(self->request->uri);
+        if (!self->uri) return nullptr;
+    }
+
+    Py_INCREF(self->uri);
+    return self->uri;
+}
+
+PyObject* request_get_query_string(RequestObject* self, void*)
+{
+    if (!self->query_string) {
+        if (!check_valid(self)) return nullptr;
+        self->query_string = to_str(self->request->query_string);
+        if (!self->query_string) return nullptr;
+    }
+
+    Py_INCREF(self->query_string);
+    return self->query_string;
+}
+
+PyObject* request_get_raw_uri(RequestObject* self, void*)
+{
+    if (!check_valid(self)) return nullptr;
+    return to_bytes(self->request->uri);
+}
+
+PyObject* request_get_raw_query_string(RequestObject* self, void*)
+{
+    if (!check_valid(self)) return nullptr;
+    return to_bytes(self->request->query_string);
+}
+
+PyObject* request_get_method(RequestObject* self, void*)
+{
+    if (!check_valid(self)) return nullptr;
+
+    auto name = method_names[(size_t) self->request->method];
+    Py_INCREF(name);
+    return name;
+}
+
+PyObject* request_get_http_major(RequestObject* self, void*)
+{
+    if (!check_valid(self)) return nullptr;
+    return PyLong_FromLong(self->request->http_major);
+}
+
+PyObject* request_get_http_minor(RequestObject* self, void*)
+{
+    if (!check_valid(self)) return nullptr;
+    return PyLong_FromLong(self->request->http_minor);
+}
+
+PyObject* request_get_headers(RequestObject* self, void*)
+{
+    if (!check_valid(self)) return nullptr;
+
+    auto headers = PyObject_New(HeadersObject, &HeadersType);
+    if (!headers) return nullptr;
+
+    Py_INCREF(self);
+    headers->owner = self;
+    return reinterpret_cast<PyObject*>(headers);
+}
+
+PyObject* request_get_body(RequestObject* self, void*)
+{
+    if (!check_valid(self)) return nullptr;
+
+    auto body = PyObject_New(BodyObject, &BodyType);
+    if (!body) return nullptr;
+
+    Py_INCREF(self);
+    body->owner = self;
+    return reinterpret_cast<PyObject*>(body);
+}
+
+PyGetSetDef request_getset[] = {
+    { "uri", (getter) request_get_uri, nullptr, nullptr, nullptr },
+    { "query_string", (getter) request_get_query_string, nullptr, nullptr, nullptr },
+    { "raw_uri", (getter) request_get_raw_uri, nullptr, nullptr, nullptr },
+    { "raw_query_string", (getter) request_get_raw_query_string, nullptr, nullptr, nullptr },
+    { "method", (getter) request_get_method, nullptr, nullptr, nullptr },
+    { "http_major", (getter) request_get_http_major, nullptr, nullptr, nullptr },
+    { "http_minor", (getter) request_get_http_minor, nullptr, nullptr, nullptr },
+    { "headers", (getter) request_get_headers, nullptr, nullptr, nullptr },
+    { "body", (getter) request_get_body, nullptr, nullptr, nullptr },
+    { nullptr, nullptr, nullptr, nullptr, nullptr },
+};
+
+/* Headers */
+
+void headers_dealloc(HeadersObject* self)
+{
+    Py_DECREF(self->owner);
+    PyObject_Free(self);
+}
+
+Py_ssize_t headers_length(HeadersObject* self)
+{
+    if (!check_valid(self->owner)) return -1;
+    return (Py_ssize_t) self->owner->request->headers.size();
+}
+
+PyObject* headers_subscript(HeadersObject* self, PyObject* key)
+{
+    auto value = find_header(self->owner, key);
+    return value ? to_str(*value) : nullptr;
+}
+
+int headers_contains(HeadersObject* self, PyObject* key)
+{
+    if (find_header(self->owner, key)) return 1;
+
+    if (PyErr_ExceptionMatches(PyExc_KeyError)) {
+        PyErr_Clear();
+        return 0;
+    }
+    return -1;
+}
+
+PyObject* headers_get(HeadersObject* self, PyObject* args)
+{
+    PyObject* key;
+    PyObject* default_value = Py_None;
+    if (!PyArg_ParseTuple(args, "O|O:get", &key, &default_value)) return nullptr;
+
+    auto value = find_header(self->owner, key);
+    if (value) return to_str(*value);
+
+    if (!PyErr_ExceptionMatches(PyExc_KeyError)) return nullptr;
+    PyErr_Clear();
+
+    Py_INCREF(default_value);
+    return default_value;
+}
+
+PyObject* headers_raw(HeadersObject* self, PyObject* key)
+{
+    auto value = find_header(self->owner, key);
+    if (value) return to_bytes(*value);
+
+    if (!PyErr_ExceptionMatches(PyExc_KeyError)) return nullptr;
+    PyErr_Clear();
+
+    Py_RETURN_NONE;
+}
+
+PyObject* headers_keys(HeadersObject* self, PyObject*)
+{
+    if (!check_valid(self->owner)) return nullptr;
+
+    auto& headers = self->owner->request->headers;
+    PyObject* keys = PyList_New((Py_ssize_t) headers.size());
+    if (!keys) return nullptr;
+
+    Py_ssize_t i = 0;
+    for (auto& entry : headers) {
+        PyObject* name = header_name(entry);
+        if (!name) {
+            Py_DECREF(keys);
+            return nullptr;
+        }
+        PyList_SET_ITEM(keys, i++, name);
+    }
+
+    return keys;
+}
+
+PyObject* headers_items(HeadersObject* self, PyObject*)
+{
+    if (!check_valid(self->owner)) return nullptr;
+
+    auto& headers = self->owner->request->headers;
+    PyObject* items = PyList_New((Py_ssize_t) headers.size());
+    if (!items) return nullptr;
+
+    Py_ssize_t i = 0;
+    for (auto& entry : headers) {
+        PyObject* name = header_name(entry);
+        PyObject* value = name ? to_str(entry.value) : nullptr;
+        PyObject* item = value ? PyTuple_Pack(2, name, value) : nullptr;
+        Py_XDECREF(name);
+        Py_XDECREF(value);
+
+        if (!item) {
+            Py_DECREF(items);
+            return nullptr;
+        }
+        PyList_SET_ITEM(items, i++, item);
+    }
+
+    return items;
+}
+
+PyObject* headers_iter(HeadersObject* self)
+{
+    PyObject* keys = headers_keys(self, nullptr);
+    if (!keys) return nullptr;
+
+    PyObject* it = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return it;
+}
+
+PyMethodDef headers_methods[] = {
+    { "get", (PyCFunction) headers_get, METH_VARARGS, nullptr },
+    { "raw", (PyCFunction) headers_raw, METH_O, nullptr },
+    { "keys", (PyCFunction) headers_keys, METH_NOARGS, nullptr },
+    { "items", (PyCFunction) headers_items, METH_NOARGS, nullptr },
+    { nullptr, nullptr, 0, nullptr },
+};
+
+/* Body */
+
+void body_dealloc(BodyObject* self)
+{
+    Py_DECREF(self->owner);
+    PyObject_Free(self);
+}
+
+Py_ssize_t body_length(BodyObject* self)
+{
+    if (!check_valid(self->owner)) return -1;
+    return (Py_ssize_t) self->owner->request->body.size();
+}
+
+/* copy up to len bytes from the current position */
+Py_ssize_t read_body(RequestObject* owner, void* buf, size_t len)
+{
+    auto& body = owner->request->body;
+    size_t nread = 0;
+    bool failed = false;
+
+    if (body.spilled()) {
+        /* the temporary file is read without holding up the other handlers */
+        Py_BEGIN_ALLOW_THREADS
+        try {
+            nread = body.read(owner->body_position, buf, len);
+        } catch (const FileIOError&) {
+            failed = true;
+        }
+        Py_END_ALLOW_THREADS
+    } else {
+        nread = body.read(owner->body_position, buf, len);
+    }
+
+    if (failed) {
+        PyErr_SetString(PyExc_OSError, "cannot read the request body");
+        return -1;
+    }
+
+    owner->body_position += nread;
+    return (Py_ssize_t) nread;
+}
+
+PyObject* body_read(BodyObject* self, PyObject* args)
+{
+    Py_ssize_t size = -1;
+    if (!PyArg_ParseTuple(args, "|n:read", &size)) return nullptr;
+    if (!check_valid(self->owner)) return nullptr;
+
+    auto owner = self->owner;
+    size_t available = owner->request->body.size() - std::min(owner->body_position, owner->request->body.size());
+    size_t len = (size < 0 || (size_t) size > available) ? available : (size_t) size;
+
+    PyObject* bytes = PyBytes_FromStringAndSize(nullptr, (Py_ssize_t) len);
+    if (!bytes || len == 0) return bytes;
+
+    Py_ssize_t nread = read_body(owner, PyBytes_AS_STRING(bytes), len);
+    if (nread < 0) {
+        Py_DECREF(bytes);
+        return nullptr;
+    }
+    if ((size_t) nread < len && _PyBytes_Resize(&bytes, nread) == -1) {
+        return nullptr;
+    }
+
+    return bytes;
+}
+
+PyObject* body_readinto(BodyObject* self, PyObject* arg)
+{
+    if (!check_valid(self->owner)) return nullptr;
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(arg, &view, PyBUF_WRITABLE | PyBUF_SIMPLE) == -1) return nullptr;
+
+    Py_ssize_t nread = read_body(self->owner, view.buf, (size_t) view.len);
+    PyBuffer_Release(&view);
+
+    return nread < 0 ? nullptr : PyLong_FromSsize_t(nread);
+}
+
+PyMethodDef body_methods[] = {
+    { "read", (PyCFunction) body_read, METH_VARARGS, nullptr },
+    { "readinto", (PyCFunction) body_readinto, METH_O, nullptr },
+    { nullptr, nullptr, 0, nullptr },
+};
+
+PySequenceMethods body_sequence = {};
+
+PyMappingMethods headers_mapping = {
+    (lenfunc) headers_length,
+    (binaryfunc) headers_subscript,
+    nullptr,
+};
+
+PySequenceMethods headers_sequence = {};
+
+}
+
+bool init_python_request_types()
+{
+    for (size_t i = 0; i < (size_t) HttpMethod::COUNT; ++i) {
+        method_names[i] = PyUnicode_InternFromString(http_method_name((HttpMethod) i));
+        if (!method_names[i]) return false;
+    }
+
+    for (size_t i = 1; i < (size_t) HeaderId::COUNT; ++i) {
+        header_names[i] = PyUnicode_InternFromString(header_id_name((HeaderId) i));
+        if (!header_names[i]) return false;
+    }
+
+    RequestType.tp_name = "porgi.HttpRequest";
+    RequestType.tp_basicsize = sizeof(RequestObject);
+    RequestType.tp_dealloc = (destructor) request_dealloc;
+    RequestType.tp_flags = Py_TPFLAGS_DEFAULT;
+    RequestType.tp_getset = request_getset;
+    if (PyType_Ready(&RequestType) < 0) return false;
+
+    headers_sequence.sq_contains = (objobjproc) headers_contains;
+
+    HeadersType.tp_name = "porgi.Headers";
+    HeadersType.tp_basicsize = sizeof(HeadersObject);
+    HeadersType.tp_dealloc = (destructor) headers_dealloc;
+    HeadersType.tp_flags = Py_TPFLAGS_DEFAULT;
+    HeadersType.tp_as_mapping = &headers_mapping;
+    HeadersType.tp_as_sequence = &headers_sequence;
+    HeadersType.tp_iter = (getiterfunc) headers_iter;
+    HeadersType.tp_methods = headers_methods;
+    if (PyType_Ready(&HeadersType) < 0) return false;
+
+    body_sequence.sq_length = (lenfunc) body_length;
+
+    BodyType.tp_name = "porgi.RequestBody";
+    BodyType.tp_basicsize = sizeof(BodyObject);
+    BodyType.tp_dealloc = (destructor) body_dealloc;
+    BodyType.tp_flags = Py_TPFLAGS_DEFAULT;
+    BodyType.tp_as_sequence = &body_sequence;
+    BodyType.tp_methods = body_methods;
+    if (PyType_Ready(&BodyType) < 0) return false;
+
+    return true;
+}
+
+PyTypeObject* get_python_request_type()
+{
+    return &RequestType;
+}
+
+PyObject* make_python_request(const HttpRequest& request)
+{
+    auto obj = PyObject_New(RequestObject, &RequestType);
+    if (!obj) return nullptr;
+
+    obj->request = &request;
+    obj->uri = nullptr;
+    obj->query_string = nullptr;
+    obj->body_position = 0;
+    return reinterpret_cast<PyObject*>(obj);
+}
+
+void invalidate_python_request(PyObject* obj)
+{
+    reinterpret_cast<RequestObject*>(obj)->request = nullptr;
+}
@@ -1,13 +1,240 @@
 #include "python_script_interface.h"
+#include "http_connection.h"
+#include "python_request.h"
+#include "response_stream.h"
 
-#include <boost/python/suite/indexing/map_indexing_suite.hpp>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace boost::python;
 
+namespace {
+
+/* Bodies borrowed from Python objects and streams are let go once the response has been sent, often on an event
+ * loop that must not wait for the GIL. Their release is queued and run by the next thread that takes it, and the
+ * waker makes sure there is one even when no request comes in. */
+class ReleaseQueue {
+public:
+    /* set once before the workers start, called without the GIL whenever the queue stops being empty */
+    static void set_waker(std::function<void()>&& waker)
+    {
+        ReleaseQueue::waker = std::move(waker);
+    }
+
+    static void push(std::function<void()>&& release)
+    {
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            was_empty = releases.empty();
+            releases.push_back(std::move(release));
+        }
+
+        if (was_empty && waker) {
+            waker();
+        }
+    }
+
+    /* with the GIL held */
+    static void drain()
+    {
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (releases.empty()) return;
+            ready.swap(releases);
+        }
+
+        for (auto& release : ready) {
+            release();
+        }
+    }
+
+private:
+    static std::mutex mutex;
+    static std::vector<std::function<void()>> releases;
+    static std::function<void()> waker;
+};
+
+std::mutex ReleaseQueue::mutex;
+std::vector<std::function<void()>> ReleaseQueue::releases;
+std::function<void()> ReleaseQueue::waker;
+
+/* Holds the GIL for a worker thread. Every worker keeps one thread state for its whole life, creating
+ * and destroying one per request like PyGILState_Ensure() does would cost more than the call itself.
+ * Guards nest, only the outermost one takes and releases the lock. */
+class GilGuard {
+public:
+    explicit GilGuard(PyInterpreterState* interpreter)
+    {
+        static thread_local PyThreadState* thread_state = nullptr;
+        if (!thread_state) {
+            thread_state = PyThreadState_New(interpreter);
+        }
+
+        if (depth++ == 0) {
+            PyEval_RestoreThread(thread_state);
+            ReleaseQueue::drain();
+        }
+    }
+
+    ~GilGuard()
+    {
+        if (--depth == 0) {
+            PyEval_SaveThread();
+        }
+    }
+
+    GilGuard(const GilGuard&) = delete;
+    GilGuard& operator=(const GilGuard&) = delete;
+
+private:
+    static thread_local int depth;
+};
+
+thread_local int GilGuard::depth = 0;
+
+/* Point the body of resp at the memory of obj, a str or any object supporting the buffer protocol, and keep obj
+ * alive until the response has been sent. Returns false for other objects. */
+bool borrow_body(PyObject* obj, HttpResponse& resp)
+{
+    std::unique_ptr<Py_buffer> view(new Py_buffer);
+
+    if (PyUnicode_Check(obj)) {
+        /* the UTF-8 form is cached in the str object and lives as long as it */
+        Py_ssize_t size;
+        const char* data = PyUnicode_AsUTF8AndSize(obj, &size);
+        if (!data || PyBuffer_FillInfo(view.get(), obj, const_cast<char*>(data), size, 1, PyBUF_SIMPLE) == -1) {
+            throw_error_already_set();
+        }
+    } else if (PyObject_CheckBuffer(obj)) {
+        if (PyObject_GetBuffer(obj, view.get(), PyBUF_SIMPLE) == -1) {
+            if (!PyErr_ExceptionMatches(PyExc_BufferError)) throw_error_already_set();
+            PyErr_Clear();
+
+            /* not contiguous, it has to be copied together */
+            if (PyObject_GetBuffer(obj, view.get(), PyBUF_FULL_RO) == -1) throw_error_already_set();
+
+            ByteBuffer body((size_t) view->len, (uint8_t) 0);
+            int ret = PyBuffer_ToContiguous(body.data(), view.get(), view->len, 'C');
+            PyBuffer_Release(view.get());
+            if (ret == -1) throw_error_already_set();
+
+            resp.body.append(body);
+            return true;
+        }
+    } else {
+        return false;
+    }
+
+    if (view->len == 0) {
+        PyBuffer_Release(view.get());
+        return true;
+    }
+
+    resp.body_data = static_cast<const uint8_t*>(view->buf);
+    resp.body_length = (size_t) view->len;
+    resp.body_owner = std::shared_ptr<Py_buffer>(view.release(), [](Py_buffer* view) {
+        ReleaseQueue::push([view]() {
+            PyBuffer_Release(view);
+            delete view;
+        });
+    });
+    return true;
+}
+
+/* A response body produced by a Python iterator, typically a generator, each item of which is a str or a
+ * bytes-like object. A generator only runs once the response is being sent, so the request object stays
+ * usable until the iterator is exhausted instead of being detached when the handler returns. */
+class PythonStream : public ResponseStream {
+public:
+    explicit PythonStream(const object& iterator)
+        : interpreter(PyThreadState_Get()->interp), iterator(iterator.ptr()), request(nullptr)
+    {
+        Py_INCREF(this->iterator);
+    }
+
+    ~PythonStream() override
+    {
+        /* a generator abandoned halfway is closed, running its finally blocks */
+        PyObject* iterator = this->iterator;
+        PyObject* request = this->request;
+        ReleaseQueue::push([iterator, request]() {
+            release(iterator, request);
+        });
+    }
+
+    /* with the GIL held */
+    void attach_request(const object& request)
+    {
+        Py_XDECREF(this->request);
+        this->request = request.ptr();
+        Py_INCREF(this->request);
+    }
+
+    bool produce(OutputQueue& out, size_t max_bytes) override
+    {
+        GilGuard gil(interpreter);
+        if (!iterator) return false;
+
+        try {
+            while (out.size() < max_bytes) {
+                PyObject* item = PyIter_Next(iterator);
+                if (!item) {
+                    if (PyErr_Occurred()) throw_error_already_set();
+
+                    finish();
+                    return false;
+                }
+
+                object holder((handle<>(item)));
+                HttpResponse piece;
+                if (!borrow_body(item, piece)) {
+                    PyErr_SetString(PyExc_TypeError, "a streamed response must yield str or bytes-like objects");
+                    throw_error_already_set();
+                }
+                out.append(std::move(piece.body));
+                out.append_shared(std::move(piece.body_owner), piece.body_data, piece.body_length);
+            }
+        } catch (error_already_set) {
+            PyErr_Print();
+            finish();
+            throw ScriptInterface::ScriptExecutionError("response stream raised an exception");
+        }
+
+        return true;
+    }
+
+private:
+    PyInterpreterState* interpreter;
+    PyObject* iterator;
+    PyObject* request;
+
+    void finish()
+    {
+        release(iterator, request);
+        iterator = nullptr;
+        request = nullptr;
+    }
+
+    static void release(PyObject* iterator, PyObject* request)
+    {
+        /* the request's memory may already be reused, detach it before a finally block can reach it */
+        if (request) {
+            invalidate_python_request(request);
+            Py_DECREF(request);
+        }
+        Py_XDECREF(iterator);
+    }
+};
+
+}
+
 struct HttpResponseProxy {
     HttpResponse resp;
 
-    HttpResponseProxy(int status, const dict& hdrs, const ByteBuffer& payload)
+    HttpResponseProxy(int status, const dict& hdrs, const object& payload)
     {
         write_head(status, hdrs);
         write(payload);
@@ -19,7 +246,7 @@ struct HttpResponseProxy {
 
         auto items = hdrs.items();
         for (int i = 0; i < len(items); ++i) {
-            auto tup = items[0];
+            auto tup = items[i];
             auto key_buf = extract<char const*>(tup[0]);
             auto value_buf = extract<char const*>(tup[1]);
             ByteBuffer key(key_buf, (size_t) len(tup[0])), value(value_buf, (size_t) len(tup[1]));
@@ -27,12 +254,147 @@ struct HttpResponseProxy {
         }
     }
 
-    void write(const ByteBuffer& payload)
+    void write(const object& payload)
     {
-        resp.body.append(payload);
+        /* a body written in one piece is sent from the object itself, or produced by it if it is an iterator */
+        if (!resp.body_owner && !resp.stream && resp.body.size() == 0) {
+            if (!borrow_body(payload.ptr(), resp)) {
+                if (!PyIter_Check(payload.ptr())) {
+                    throw_invalid_body();
+                }
+                resp.stream = std::make_shared<PythonStream>(payload);
+            }
+            return;
+        }
+
+        /* one written in several is put together */
+        if (resp.stream) {
+            PyErr_SetString(PyExc_TypeError, "a streamed body cannot be written to");
+            throw_error_already_set();
+        }
+        HttpResponse piece;
+        if (!borrow_body(payload.ptr(), piece)) {
+            throw_invalid_body();
+        }
+        if (resp.body_owner) {
+            resp.body.append(resp.body_data, resp.body_length);
+            resp.body_owner.reset();
+            resp.body_data = nullptr;
+            resp.body_length = 0;
+        }
+        resp.body.append(piece.body);
+        resp.body.append(piece.body_data, piece.body_length);
+    }
+
+    static void throw_invalid_body()
+    {
+        PyErr_SetString(PyExc_TypeError, "a response body must be a str, a bytes-like object or an iterator");
+        throw_error_already_set();
     }
 };
 
+namespace detail_handler {
+
+object wrap_request(const HttpRequest& request)
+{
+    return object(handle<>(make_python_request(request)));
+}
+
+/* detaches the Python request object from the request once the handler is done with it */
+struct RequestScope {
+    object request;
+
+    ~RequestScope()
+    {
+        /* unless a streamed response has taken it over */
+        if (!request.is_none()) {
+            invalidate_python_request(request.ptr());
+        }
+    }
+};
+
+object call_handler(const object& f, const object& request, const UrlMap::UrlParams& params)
+{
+    if (params.empty()) {
+        return call<object>(f.ptr(), request);
+    }
+
+    dict params_dict;
+    for (auto& param : params) {
+        auto name = str(reinterpret_cast<const char*>(param.name->data()), param.name->size());
+
+        /* already validated while matching, only the conversion is left */
+        if (param.type == UrlMap::ParamType::INT) {
+            params_dict[name] = param.int_value;
+        } else {
+            params_dict[name] = str(reinterpret_cast<const char*>(params.value(param)), param.length);
+        }
+    }
+
+    return call<object>(f.ptr(), request, params_dict);
+}
+
+HttpResponse to_response(const object& obj, RequestScope& scope)
+{
+    /* a returned str or bytes-like value is the body, an iterator produces it */
+    HttpResponse resp;
+    if (borrow_body(obj.ptr(), resp)) {
+        resp.status_code = 200;
+        if (PyUnicode_Check(obj.ptr())) {
+            resp.headers.set(HeaderId::CONTENT_TYPE, "text/plain", 10);
+        } else {
+            resp.headers.set(HeaderId::CONTENT_TYPE, "application/octet-stream", 24);
+        }
+    } else if (PyIter_Check(obj.ptr())) {
+        resp.status_code = 200;
+        resp.headers.set(HeaderId::CONTENT_TYPE, "application/octet-stream", 24);
+        resp.stream = std::make_shared<PythonStream>(obj);
+    } else {
+        HttpResponseProxy& proxy = extract<HttpResponseProxy&>(obj);
+        resp = proxy.resp;
+        /* an iterator can only be consumed once */
+        proxy.resp.stream.reset();
+    }
+
+    if (resp.stream) {
+        static_cast<PythonStream&>(*resp.stream).attach_request(scope.request);
+        scope.request = object();
+    }
+
+    return resp;
+}
+
+/* Passed to the future of an async handler, it completes the response on the event loop's thread. */
+struct AsyncCompletion {
+    object request;
+    UrlMap::ResponseCallback callback;
+
+    void done(const object& future)
+    {
+        HttpResponse response;
+        try {
+            RequestScope scope{request};
+            response = to_response(future.attr("result")(), scope);
+        } catch (error_already_set) {
+            PyErr_Print();
+            response = HttpConnection::make_error_response(500);
+        } catch (...) {
+            /* the request holds a reference to the connection, it has to be answered whatever went wrong */
+            if (PyErr_Occurred()) {
+                PyErr_Print();
+            }
+            response = HttpConnection::make_error_response(500);
+        }
+
+        /* writing to the connection needs no interpreter */
+        Py_BEGIN_ALLOW_THREADS
+        callback(std::move(response));
+        Py_END_ALLOW_THREADS
+    }
+};
+
+}
+
 namespace detail_converter {
 
 struct http_method_to_python_str {
@@ -84,11 +446,16 @@ void init_converters()
 }
 }
 
-PythonScriptInterface::PythonScriptInterface(const std::string& path) : ScriptInterface(path)
+PythonScriptInterface::PythonScriptInterface(const std::string& path)
+    : ScriptInterface(path), server(nullptr), interpreter(nullptr), has_async_routes(false)
 {
     Py_Initialize();
 
     detail_converter::init_converters();
+    if (!init_python_request_types()) {
+        PyErr_Print();
+        throw ScriptExecutionError("cannot create the request types");
+    }
 }
 
 void PythonScriptInterface::load_script(HttpServer* server)
@@ -113,6 +480,27 @@ void PythonScriptInterface::load_script(HttpServer* server)
         PyErr_Print();
         throw ScriptExecutionError(get_error_string());
     }
+
+    /* from now on the interpreter is only entered by the workers, each of which takes the GIL */
+    interpreter = PyThreadState_Get()->interp;
+    /* the workers only take the GIL as requests come in and the asyncio thread holds it for good, so releases
+     * queued on an idle server get a worker of their own */
+    ReleaseQueue::set_waker([this]() {
+        this->server->run_on_worker([this]() {
+            GilGuard gil(interpreter);
+        });
+    });
+
+    if (has_async_routes) {
+        start_event_loop();
+    }
+    PyEval_SaveThread();
+}
+
+void PythonScriptInterface::run_batch(const std::function<void()>& batch)
+{
+    GilGuard gil(interpreter);
+    batch();
 }
 
 void PythonScriptInterface::inject_namespace(boost::python::object& _namespace)
@@ -122,85 +510,136 @@ void PythonScriptInterface::inject_namespace(boost::python::object& _namespace)
     ;
 
     _namespace["Porgi"] = class_<PythonScriptInterface>("Porgi", init<std::string>())
-        .def("register_route", &PythonScriptInterface::_py_register_route);
+        .def("register_route", &PythonScriptInterface::_py_register_route)
+        .def("static", &PythonScriptInterface::_py_register_static)
+        .def("cache_stats", &PythonScriptInterface::_py_cache_stats);
     _namespace["porgi"] = ptr(this);
 
     _namespace["ByteBuffer"] = class_<ByteBuffer>("ByteBuffer")
         .def("__len__", &ByteBuffer::size)
         .def("__str__", &ByteBuffer::to_string);
 
-    _namespace["HeaderMap"] = class_<HeaderMap>("HeaderMap")
-        .def(map_indexing_suite<HeaderMap>());
-
-    _namespace["HttpRequest"] = class_<HttpRequest>("HttpRequest")
-        .add_property("uri", &HttpRequest::uri)
-        .add_property("method", &HttpRequest::method)
-        .add_property("http_major", &HttpRequest::http_major)
-        .add_property("http_minor", &HttpRequest::http_minor)
-        .add_property("headers", &HttpRequest::headers);
+    _namespace["HttpRequest"] = object(handle<>(borrowed(reinterpret_cast<PyObject*>(get_python_request_type()))));
 
-    _namespace["_HttpResponse"] = class_<HttpResponseProxy>("HttpResponse", init<int, dict, ByteBuffer>())
+    _namespace["_HttpResponse"] = class_<HttpResponseProxy>("HttpResponse", init<int, dict, object>())
         .def("write_head", &HttpResponseProxy::write_head)
         .def("write", &HttpResponseProxy::write);
 
+    _namespace["_AsyncCompletion"] = class_<detail_handler::AsyncCompletion>("AsyncCompletion", no_init)
+        .def("__call__", &detail_handler::AsyncCompletion::done);
+
     exec(prelude, _namespace, _namespace);
 }
 
-void PythonScriptInterface::_py_register_route(const ByteBuffer& rule, const object& f, const list& methods)
+void PythonScriptInterface::_py_register_route(const ByteBuffer& rule, const object& f, const list& methods,
+                                               double cache_ttl, const list& vary)
 {
     std::vector<HttpMethod> methods_v;
     for (int i = 0; i < len(methods); ++i) {
         char const* method = extract<char const*>(methods[i]);
 
-        if (std::strcmp(method, "GET") == 0) {
-            methods_v.push_back(HttpMethod::GET);
-        } else {
+        auto met = lookup_http_method(method, std::strlen(method));
+        if (met == HttpMethod::UNKNOWN) {
             PyErr_SetString(PyExc_ValueError, "unknown HTTP method");
             return;
         }
+        methods_v.push_back(met);
     }
 
-    server->register_url_rule(
-        rule,
-        handler_wrapper(f),
-        methods_v
-    );
+    UrlMap::CachePolicy cache;
+    if (cache_ttl > 0) {
+        cache.ttl = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(cache_ttl));
+        for (int i = 0; i < len(vary); ++i) {
+            cache.vary.push_back(extract<ByteBuffer>(vary[i]));
+        }
+    }
+
+    UrlMap::Route route;
+    if (extract<bool>(import("inspect").attr("iscoroutinefunction")(f))) {
+        route.async_handler = async_handler_wrapper(f);
+        has_async_routes = true;
+    } else {
+        route.handler = handler_wrapper(f);
+    }
+    route.cache = cache;
+
+    server->register_url_rule(rule, route, methods_v);
 }
 
-UrlMap::RequestHandler PythonScriptInterface::handler_wrapper(const boost::python::object& f)
+void PythonScriptInterface::_py_register_static(const ByteBuffer& prefix, const std::string& directory)
 {
-    return UrlMap::RequestHandler([this, f](const HttpRequest& request, const UrlMap::UrlPatternMap& pattern_map) {
-        try {
-            object obj;
+    server->register_static(prefix, directory);
+}
 
-            if (pattern_map.empty()) {
-                obj = call<object>(f.ptr(), boost::ref(request));
-            } else {
-                obj = call<object>(f.ptr(), boost::ref(request), boost::ref(pattern_map));
-            }
+dict PythonScriptInterface::_py_cache_stats() const
+{
+    auto& cache = server->get_response_cache();
+
+    dict stats;
+    stats["hits"] = cache.get_hits();
+    stats["misses"] = cache.get_misses();
+    stats["entries"] = cache.get_size();
+    stats["bytes"] = cache.get_bytes();
+    stats["capacity"] = cache.get_capacity();
+    return stats;
+}
 
-            /* returned str value */
-            extract<char const*> ext(obj);
-            if (ext.check()) {
-                HttpResponse resp;
+UrlMap::RequestHandler PythonScriptInterface::handler_wrapper(const boost::python::object& f)
+{
+    return UrlMap::RequestHandler([this, f](const HttpRequest& request, const UrlMap::UrlParams& params) {
+        GilGuard gil(interpreter);
 
-                resp.status_code = 200;
-                resp.headers[ByteBuffer("Content-Type")] = ByteBuffer("text/plain");
-                char const* body = ext;
-                resp.body.append(body, std::strlen(body));
+        try {
+            detail_handler::RequestScope scope{detail_handler::wrap_request(request)};
+            return detail_handler::to_response(detail_handler::call_handler(f, scope.request, params), scope);
+        } catch(error_already_set) {
+            PyErr_Print();
+            throw ScriptExecutionError(get_error_string());
+        }
+    });
+}
 
-                return resp;
-            }
+UrlMap::AsyncRequestHandler PythonScriptInterface::async_handler_wrapper(const boost::python::object& f)
+{
+    return UrlMap::AsyncRequestHandler([this, f](const HttpRequest& request, const UrlMap::UrlParams& params,
+                                                 UrlMap::ResponseCallback& callback) {
+        GilGuard gil(interpreter);
 
-            HttpResponseProxy proxy = extract<HttpResponseProxy&>(obj);
-            return proxy.resp;
+        /* the request stays usable until the coroutine has finished */
+        object request_obj = detail_handler::wrap_request(request);
+        try {
+            object coroutine = detail_handler::call_handler(f, request_obj, params);
+            object future = run_coroutine_threadsafe(coroutine, event_loop);
+            future.attr("add_done_callback")(detail_handler::AsyncCompletion{request_obj, callback});
         } catch(error_already_set) {
+            invalidate_python_request(request_obj.ptr());
             PyErr_Print();
             throw ScriptExecutionError(get_error_string());
         }
+
+        callback = nullptr;
     });
 }
 
+void PythonScriptInterface::start_event_loop()
+{
+    object asyncio = import("asyncio");
+    event_loop = asyncio.attr("new_event_loop")();
+    run_coroutine_threadsafe = asyncio.attr("run_coroutine_threadsafe");
+
+    /* the loop mostly waits in select(), which releases the GIL */
+    std::thread([this]() {
+        GilGuard gil(interpreter);
+
+        try {
+            event_loop.attr("run_forever")();
+        } catch (error_already_set) {
+            PyErr_Print();
+        }
+    }).detach();
+}
+
 std::string PythonScriptInterface::get_error_string() const
 {
     PyObject *ptype, *pvalue, *ptraceback;
@@ -0,0 +1,147 @@
+#include "reactor.h"
+#include "http_server.h"
+#include "http_connection.h"
+#include "easylogging++.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <cstring>
+#include <stdexcept>
+
+/* sent as-is to clients that arrive while the connection pool is full */
+static const char SERVICE_UNAVAILABLE[] =
+    "HTTP/1.1 503 Service Unavailable\r\nServer: Porgi\r\nConnection: close\r\nContent-length: 0\r\n\r\n";
+
+Reactor::Reactor(HttpServer* server, int index, size_t max_connections, int cpu, int shared_listen_fd)
+    : server(server), index(index), cpu(cpu), pool(max_connections)
+{
+    if (shared_listen_fd == -1) {
+        listen_fd = open_listenfd(server->get_host(), server->get_port(), server->get_backlog());
+        if (listen_fd == -1) {
+            throw std::runtime_error("cannot open listen socket");
+        }
+    } else {
+        listen_fd = shared_listen_fd;
+    }
+
+    if (make_socket_non_blocking(listen_fd) == -1) {
+        throw std::runtime_error("failed to make socket non-blocking");
+    }
+
+    backend = IoBackend::create(server->get_io_backend(), this, listen_fd, shared_listen_fd != -1, &completions);
+}
+
+Reactor::~Reactor()
+{
+    backend.reset();
+    ::close(listen_fd);
+}
+
+void Reactor::run()
+{
+    if (cpu >= 0) {
+        pin_to_cpu();
+    }
+    completions.bind_to_current_thread();
+    backend->start();
+
+    while(true) {
+        backend->poll();
+
+        server->flush_dispatch();
+
+        /* closed connections stay in place until the end of the batch, which may still hold events for them */
+        pool.collect();
+    }
+}
+
+void Reactor::accept_connection(int conn_fd)
+{
+    LOG(DEBUG) << "Accepting new connection on reactor " << index << ", fd = " << conn_fd;
+
+    /* responses are written in one writev each, there is nothing to gain from Nagle */
+    int opt = 1;
+    setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    auto new_conn = pool.acquire(server, backend.get(), &completions, conn_fd);
+    if (!new_conn) {
+        reject_connection(conn_fd);
+        return;
+    }
+
+    backend->add_connection(new_conn);
+}
+
+void Reactor::reject_connection(int conn_fd)
+{
+    LOG(DEBUG) << "Rejecting connection on reactor " << index << ", " << pool.get_size() << " connections open";
+
+    /* best effort, the socket buffer of a fresh connection has room for this */
+    if (write(conn_fd, SERVICE_UNAVAILABLE, sizeof(SERVICE_UNAVAILABLE) - 1) < 0) {
+        LOG(DEBUG) << "io write error(" << errno << "), fd = " << conn_fd;
+    }
+    ::close(conn_fd);
+}
+
+void Reactor::pin_to_cpu()
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (err != 0) {
+        LOG(WARNING) << "failed to pin reactor " << index << " to cpu " << cpu << "(" << err << ")";
+    }
+}
+
+int Reactor::open_listenfd(const std::string& host, uint16_t port, int backlog)
+{
+    int sfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(sfd == -1) {
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    /* every reactor binds its own socket to the same port and the kernel balances connections among them */
+    if (setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        ::close(sfd);
+        return -1;
+    }
+
+    struct sockaddr_in sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = inet_addr(host.c_str());
+    if (bind(sfd, (struct sockaddr*)&sa, sizeof(struct sockaddr)) == -1) {
+        ::close(sfd);
+        return -1;
+    }
+
+    if (listen(sfd, backlog) == -1) {
+        ::close(sfd);
+        return -1;
+    }
+
+    return sfd;
+}
+
+int Reactor::make_socket_non_blocking(int sfd)
+{
+    int flags = fcntl (sfd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    if(fcntl (sfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "request_body.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+RequestBody::~RequestBody()
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+void RequestBody::append(const void* data, size_t len)
+{
+    auto p = static_cast<const uint8_t*>(data);
+
+    if (memory.size() < memory_limit) {
+        size_t n = std::min(len, memory_limit - memory.size());
+        memory.append(p, n);
+        p += n;
+        len -= n;
+        length += n;
+    }
+    if (len == 0) return;
+
+    spill.append(p, len);
+    length += len;
+}
+
+ByteBuffer RequestBody::take_spill()
+{
+    ByteBuffer batch(std::move(spill));
+    spill.clear();
+
+    return batch;
+}
+
+void RequestBody::write_spill(const ByteBuffer& batch)
+{
+    if (fd == -1) {
+        open_spill_file();
+    }
+
+    /* the file is appended to sequentially, the kernel keeps the offset */
+    auto p = batch.data();
+    size_t len = batch.size();
+    while (len > 0) {
+        ssize_t nwritten = write(fd, p, len);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            throw FileIOError("cannot write request body to temporary file");
+        }
+
+        p += nwritten;
+        len -= (size_t) nwritten;
+    }
+}
+
+size_t RequestBody::read(size_t offset, void* buf, size_t len) const
+{
+    if (offset >= length) return 0;
+    len = std::min(len, length - offset);
+
+    auto p = static_cast<uint8_t*>(buf);
+    size_t copied = 0;
+
+    if (offset < memory.size()) {
+        size_t n = std::min(len, memory.size() - offset);
+        std::memcpy(p, memory.data() + offset, n);
+        copied += n;
+    }
+
+    while (copied < len) {
+        ssize_t nread = pread(fd, p + copied, len - copied, (off_t) (offset + copied - memory.size()));
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            throw FileIOError("cannot read request body from temporary file");
+        }
+        if (nread == 0) break;
+
+        copied += (size_t) nread;
+    }
+
+    return copied;
+}
+
+void RequestBody::open_spill_file()
+{
+    const char* dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+
+    /* never linked into the directory, it is gone as soon as it is closed */
+    fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd != -1) return;
+
+    /* filesystems without O_TMPFILE */
+    std::string path = std::string(dir) + "/porgi-body-XXXXXX";
+    fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd == -1) {
+        throw FileIOError("cannot create temporary file for request body");
+    }
+    unlink(path.c_str());
+}
@@ -0,0 +1,115 @@
+#include "response_cache.h"
+
+static_assert(ResponseCache::NSHARDS == 16, "shards are selected by the top four bits of the hash");
+
+std::shared_ptr<const SerializedResponse> ResponseCache::get(const ByteBuffer& key, uint64_t hash)
+{
+    auto& shard = get_shard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto entry = find(shard, key, hash);
+    if (entry == shard.lru.end()) {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    if (Clock::now() >= entry->expires) {
+        erase(shard, entry);
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    return entry->response;
+}
+
+void ResponseCache::put(const ByteBuffer& key, uint64_t hash, std::shared_ptr<const SerializedResponse> response,
+                        Clock::duration ttl)
+{
+    size_t charge = sizeof(Entry) + key.size() + response->head.size() + response->tail.size();
+    size_t shard_capacity = capacity / NSHARDS;
+    if (charge > shard_capacity) return;
+
+    auto& shard = get_shard(hash);
+    Entry entry{hash, ByteBuffer(key.data(), key.size()), std::move(response), Clock::now() + ttl, charge};
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = find(shard, key, hash);
+    if (it != shard.lru.end()) {
+        erase(shard, it);
+    }
+
+    while (shard.bytes + charge > shard_capacity && !shard.lru.empty()) {
+        erase(shard, std::prev(shard.lru.end()));
+    }
+
+    shard.lru.push_front(std::move(entry));
+    shard.index.emplace(hash, shard.lru.begin());
+    shard.bytes += charge;
+}
+
+std::list<ResponseCache::Entry>::iterator ResponseCache::find(Shard& shard, const ByteBuffer& key, uint64_t hash)
+{
+    auto range = shard.index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->key == key) {
+            return it->second;
+        }
+    }
+
+    return shard.lru.end();
+}
+
+void ResponseCache::erase(Shard& shard, std::list<Entry>::iterator it)
+{
+    auto range = shard.index.equal_range(it->hash);
+    for (auto index_it = range.first; index_it != range.second; ++index_it) {
+        if (index_it->second == it) {
+            shard.index.erase(index_it);
+            break;
+        }
+    }
+
+    shard.bytes -= it->charge;
+    shard.lru.erase(it);
+}
+
+uint64_t ResponseCache::get_hits() const
+{
+    uint64_t hits = 0;
+    for (auto& shard : shards) {
+        hits += shard.hits.load(std::memory_order_relaxed);
+    }
+    return hits;
+}
+
+uint64_t ResponseCache::get_misses() const
+{
+    uint64_t misses = 0;
+    for (auto& shard : shards) {
+        misses += shard.misses.load(std::memory_order_relaxed);
+    }
+    return misses;
+}
+
+size_t ResponseCache::get_size() const
+{
+    size_t size = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size += shard.lru.size();
+    }
+    return size;
+}
+
+size_t ResponseCache::get_bytes() const
+{
+    size_t bytes = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}
@@ -1,34 +1,67 @@
 #include "route.h"
 
-void UrlMap::register_rule(const ByteBuffer& rule, UrlMap::RequestHandler&& handler, const std::vector<HttpMethod>& methods)
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+const UrlMap::UrlParams::Param* UrlMap::UrlParams::find(const char* name, size_t len) const
+{
+    for (auto& param : *this) {
+        if (param.name->size() == len && std::memcmp(param.name->data(), name, len) == 0) {
+            return &param;
+        }
+    }
+
+    return nullptr;
+}
+
+void UrlMap::register_rule(const ByteBuffer& rule, const Route& route, const std::vector<HttpMethod>& methods)
 {
+    if (compiled) {
+        throw InvalidUrlRule("the URL map has already been compiled");
+    }
+
     if (rule.size() == 0 || rule[0] != '/') {
         throw InvalidUrlRule("path is not absolute");
     }
 
     UrlEntry* entry = &root;
+    size_t nparams = 0;
     size_t begin_index = 1;
     for (size_t i = 1; i <= rule.size(); i++) {
-        if (rule[i] == '/' || i == rule.size()) {
+        if (i == rule.size() || rule[i] == '/') {
             ByteBuffer part(rule.data() + begin_index, i - begin_index);
 
             if (i == rule.size() && part.size() == 0) break; /* trailing slash */
 
-            if (part[0] == ':') { /* pattern */
-                entry->pattern_name = ByteBuffer(part.data() + 1, part.size() - 1);
-                if (entry->pattern_name.size() == 0) {
-                    throw InvalidUrlRule("empty pattern");
+            if (part.size() > 0 && part[0] == ':') { /* pattern */
+                ByteBuffer name;
+                ParamType type;
+                if (!parse_param(part.data() + 1, part.size() - 1, name, type)) {
+                    throw InvalidUrlRule("invalid pattern");
+                }
+                if (type == ParamType::PATH && i != rule.size()) {
+                    throw InvalidUrlRule("a path pattern must be the last segment");
+                }
+                if (++nparams > UrlParams::MAX_PARAMS) {
+                    throw InvalidUrlRule("too many patterns");
                 }
 
-                entry->pattern_entry = std::make_unique<UrlEntry>();
-                entry = entry->pattern_entry.get();
+                auto it = std::find_if(entry->params.begin(), entry->params.end(),
+                                       [&name, type](const UrlEntry::ParamChild& child) {
+                                           return child.type == type && child.name == name;
+                                       });
+                if (it == entry->params.end()) {
+                    entry->params.push_back(UrlEntry::ParamChild{std::move(name), type, std::make_unique<UrlEntry>()});
+                    it = entry->params.end() - 1;
+                }
+                entry = it->entry.get();
             } else {
-                auto it = entry->children.find(part);
-                if (it == entry->children.end()) {
-                    auto new_entry = std::make_unique<UrlEntry>();
-                    entry->children[part] = std::move(new_entry);
+                auto& child = entry->children[part];
+                if (!child) {
+                    child = std::make_unique<UrlEntry>();
                 }
-                entry = entry->children[part].get();
+                entry = child.get();
             }
 
             begin_index = i + 1;
@@ -36,43 +69,291 @@ void UrlMap::register_rule(const ByteBuffer& rule, UrlMap::RequestHandler&& hand
     }
 
     for (auto mth : methods) {
-        entry->handlers[mth] = handler;
+        entry->handlers[mth] = route;
     }
 }
 
-UrlMap::RequestHandler UrlMap::match_url(const ByteBuffer& url, HttpMethod method, UrlPatternMap& pattern_map)
+bool UrlMap::parse_param(const uint8_t* segment, size_t len, ByteBuffer& name, ParamType& type)
 {
-    if (url.size() == 0 || url[0] != '/') {
-        throw UnmatchedUrl("path is not absolute");
+    type = ParamType::STRING;
+
+    auto open = static_cast<const uint8_t*>(std::memchr(segment, '<', len));
+    if (open) {
+        if (segment[len - 1] != '>') return false;
+
+        auto converter = reinterpret_cast<const char*>(open + 1);
+        size_t converter_len = (size_t) (segment + len - 1 - (open + 1));
+        if (converter_len == 3 && std::memcmp(converter, "int", 3) == 0) {
+            type = ParamType::INT;
+        } else if (converter_len == 4 && std::memcmp(converter, "uuid", 4) == 0) {
+            type = ParamType::UUID;
+        } else if (converter_len == 4 && std::memcmp(converter, "path", 4) == 0) {
+            type = ParamType::PATH;
+        } else if (!(converter_len == 6 && std::memcmp(converter, "string", 6) == 0)) {
+            return false;
+        }
+
+        len = (size_t) (open - segment);
     }
 
-    UrlEntry* entry = &root;
-    size_t begin_index = 1;
-    for (size_t i = 1; i <= url.size(); i++) {
-        if (url[i] == '/' || i == url.size()) {
-            ByteBuffer part(url.data() + begin_index, i - begin_index);
+    if (len == 0) return false;
 
-            if (i == url.size() && part.size() == 0) break; /* trailing slash */
+    name = ByteBuffer(segment, len);
+    return true;
+}
 
-            if (entry->pattern_entry) { /* pattern */
-                pattern_map[entry->pattern_name] = part;
-                entry = entry->pattern_entry.get();
-            } else {
-                auto it = entry->children.find(part);
-                if (it == entry->children.end()) {
-                    throw UnmatchedUrl("no handler for this URL");
-                }
+static inline bool is_hex_digit(uint8_t c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+bool UrlMap::convert_param(ParamType type, const uint8_t* value, size_t len, int64_t& int_value)
+{
+    switch (type) {
+    case ParamType::INT: {
+        size_t i = 0;
+        bool negative = len > 0 && value[0] == '-';
+        if (negative) i++;
+        if (i == len) return false;
+
+        /* accumulated as a negative number, which has the larger range */
+        int64_t result = 0;
+        for (; i < len; ++i) {
+            if (value[i] < '0' || value[i] > '9') return false;
 
-                entry = it->second.get();
+            int digit = value[i] - '0';
+            if (result < (INT64_MIN + digit) / 10) return false;
+            result = result * 10 - digit;
+        }
+
+        if (!negative) {
+            if (result == INT64_MIN) return false;
+            result = -result;
+        }
+
+        int_value = result;
+        return true;
+    }
+    case ParamType::UUID:
+        /* 8-4-4-4-12 hex digits */
+        if (len != 36) return false;
+        for (size_t i = 0; i < len; ++i) {
+            if (i == 8 || i == 13 || i == 18 || i == 23) {
+                if (value[i] != '-') return false;
+            } else if (!is_hex_digit(value[i])) {
+                return false;
             }
-            begin_index = i + 1;
         }
+        return true;
+    default:
+        return len > 0;
     }
+}
+
+void UrlMap::compile()
+{
+    nodes.clear();
+    child_edges.clear();
+    param_edges.clear();
+    method_routes.clear();
+    routes.clear();
+    labels.clear();
+    param_names.clear();
+
+    compile_entry(root);
+
+    /* the handlers have been moved into the table */
+    root = UrlEntry();
+    compiled = true;
+}
+
+static int param_rank(UrlMap::ParamType type)
+{
+    switch (type) {
+    case UrlMap::ParamType::INT:
+    case UrlMap::ParamType::UUID:
+        return 0;
+    case UrlMap::ParamType::STRING:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+uint32_t UrlMap::compile_entry(UrlEntry& entry)
+{
+    /* nodes and edges are appended to while the children are compiled, they are only accessed by index */
+    uint32_t index = (uint32_t) nodes.size();
+    nodes.emplace_back();
+
+    nodes[index].first_method = (uint32_t) method_routes.size();
+    nodes[index].nmethods = (uint32_t) entry.handlers.size();
+    for (auto& it : entry.handlers) {
+        method_routes.push_back(MethodRoute{it.first, (uint32_t) routes.size()});
+        routes.push_back(std::move(it.second));
+    }
+
+    /* the edges of a node are reserved before recursing so that they stay contiguous */
+    uint32_t first_child = (uint32_t) child_edges.size();
+    nodes[index].first_child = first_child;
+    nodes[index].nchildren = (uint32_t) entry.children.size();
+    child_edges.resize(first_child + entry.children.size());
+
+    /* the most specific parameters are tried first, a path only if nothing else matches */
+    std::stable_sort(entry.params.begin(), entry.params.end(),
+                     [](const UrlEntry::ParamChild& a, const UrlEntry::ParamChild& b) {
+                         return param_rank(a.type) < param_rank(b.type);
+                     });
+
+    uint32_t first_param = (uint32_t) param_edges.size();
+    nodes[index].first_param = first_param;
+    nodes[index].nparams = (uint32_t) entry.params.size();
+    param_edges.resize(first_param + entry.params.size());
+
+    uint32_t i = 0;
+    for (auto& it : entry.children) {
+        uint32_t offset = (uint32_t) labels.size();
+        labels.append(it.first);
+
+        uint32_t node = compile_entry(*it.second);
+        child_edges[first_child + i] = Edge{offset, (uint32_t) it.first.size(), node};
+        i++;
+    }
+
+    i = 0;
+    for (auto& it : entry.params) {
+        uint32_t name = (uint32_t) param_names.size();
+        param_names.push_back(it.name);
+
+        uint32_t node = compile_entry(*it.entry);
+        param_edges[first_param + i] = ParamEdge{name, it.type, node};
+        i++;
+    }
+
+    return index;
+}
+
+const UrlMap::Route* UrlMap::match_url(const ByteBuffer& url, HttpMethod method, UrlParams& params) const
+{
+    if (!compiled || url.size() == 0 || url[0] != '/') {
+        return nullptr;
+    }
+
+    params.url = &url;
+    params.count = 0;
+
+    return match_node(nodes[0], url, 1, method, params);
+}
+
+const UrlMap::Route* UrlMap::match_node(const Node& node, const ByteBuffer& url, size_t pos, HttpMethod method,
+                                        UrlParams& params) const
+{
+    /* the whole URL has been consumed, or only a trailing slash is left */
+    if (pos >= url.size()) {
+        return find_route(node, method);
+    }
+
+    auto segment = url.data() + pos;
+    auto slash = static_cast<const uint8_t*>(std::memchr(segment, '/', url.size() - pos));
+    size_t len = slash ? (size_t) (slash - segment) : url.size() - pos;
+    size_t next = pos + len + 1;
+
+    auto child = find_child(node, segment, len);
+    if (child) {
+        auto route = match_node(*child, url, next, method, params);
+        if (route) return route;
+    }
+
+    for (uint32_t i = 0; i < node.nparams; ++i) {
+        auto& edge = param_edges[node.first_param + i];
+
+        /* a path takes the rest of the URL */
+        size_t value_len = edge.type == ParamType::PATH ? url.size() - pos : len;
+        size_t value_next = edge.type == ParamType::PATH ? url.size() : next;
+
+        auto& param = params.params[params.count];
+        if (!convert_param(edge.type, segment, value_len, param.int_value)) continue;
+        param.name = &param_names[edge.name];
+        param.type = edge.type;
+        param.offset = (uint32_t) pos;
+        param.length = (uint32_t) value_len;
+        params.count++;
+
+        auto route = match_node(nodes[edge.node], url, value_next, method, params);
+        if (route) return route;
+
+        params.count--;
+    }
+
+    return nullptr;
+}
+
+const UrlMap::Route* UrlMap::find_route(const Node& node, HttpMethod method) const
+{
+    const Route* get_route = nullptr;
+    for (uint32_t i = 0; i < node.nmethods; ++i) {
+        auto& entry = method_routes[node.first_method + i];
+        if (entry.method == method) {
+            return &routes[entry.route];
+        }
+        if (entry.method == HttpMethod::GET) {
+            get_route = &routes[entry.route];
+        }
+    }
+
+    /* a HEAD request is answered like a GET, the body is left out when it is sent */
+    return method == HttpMethod::HEAD ? get_route : nullptr;
+}
+
+const UrlMap::Node* UrlMap::find_child(const Node& node, const uint8_t* segment, size_t len) const
+{
+    auto first = child_edges.begin() + node.first_child;
+    auto last = first + node.nchildren;
+
+    /* the same order as ByteBuffer::operator<, which the edges were sorted with */
+    auto it = std::lower_bound(first, last, len, [this, segment](const Edge& edge, size_t len) {
+        if (edge.length != len) return edge.length < len;
+        return std::memcmp(labels.data() + edge.offset, segment, len) < 0;
+    });
+
+    if (it == last || it->length != len || std::memcmp(labels.data() + it->offset, segment, len) != 0) {
+        return nullptr;
+    }
+
+    return &nodes[it->node];
+}
+
+void UrlMap::register_mount(const ByteBuffer& prefix, MountHandler&& handler, const std::vector<HttpMethod>& methods)
+{
+    if (prefix.size() == 0 || prefix[0] != '/') {
+        throw InvalidUrlRule("mount point is not absolute");
+    }
+
+    /* "/assets/" and "/assets" are the same mount point, "/" mounts everything */
+    size_t len = prefix.size();
+    while (len > 0 && prefix[len - 1] == '/') len--;
+
+    Mount mount{ByteBuffer(prefix.data(), len), methods, std::move(handler)};
+    auto it = std::find_if(mounts.begin(), mounts.end(), [len](const Mount& m) { return m.prefix.size() < len; });
+    mounts.insert(it, std::move(mount));
+}
+
+const UrlMap::MountHandler* UrlMap::match_mount(const ByteBuffer& url, HttpMethod method, size_t& prefix_len) const
+{
+    for (auto& mount : mounts) {
+        auto& prefix = mount.prefix;
+
+        if (url.size() < prefix.size() || std::memcmp(url.data(), prefix.data(), prefix.size()) != 0) continue;
+        if (url.size() > prefix.size() && url[prefix.size()] != '/') continue;
+        auto& methods = mount.methods;
+        if (std::find(methods.begin(), methods.end(), method) == methods.end() &&
+            !(method == HttpMethod::HEAD && std::find(methods.begin(), methods.end(), HttpMethod::GET) != methods.end())) {
+            continue;
+        }
 
-    auto it = entry->handlers.find(method);
-    if (it == entry->handlers.end()) {
-        throw UnmatchedUrl("no handler for this method");
+        prefix_len = prefix.size();
+        return &mount.handler;
     }
 
-    return it->second;
+    return nullptr;
 }
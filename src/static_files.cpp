@@ -0,0 +1,246 @@
+#include "static_files.h"
+#include "http_connection.h"
+
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <strings.h>
+
+struct ContentType {
+    const char* extension;
+    const char* type;
+};
+
+static const ContentType content_types[] = {
+    { "html", "text/html; charset=utf-8" },
+    { "htm", "text/html; charset=utf-8" },
+    { "css", "text/css; charset=utf-8" },
+    { "js", "application/javascript" },
+    { "mjs", "application/javascript" },
+    { "json", "application/json" },
+    { "map", "application/json" },
+    { "txt", "text/plain; charset=utf-8" },
+    { "xml", "application/xml" },
+    { "svg", "image/svg+xml" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "ico", "image/x-icon" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf", "font/ttf" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+    { "mp4", "video/mp4" },
+    { "webm", "video/webm" },
+};
+
+StaticFiles::StaticFiles(const std::string& root, FileCache* cache) : root(root), cache(cache)
+{
+    while (this->root.size() > 1 && this->root.back() == '/') {
+        this->root.pop_back();
+    }
+}
+
+static inline int hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool StaticFiles::resolve_path(const uint8_t* path, size_t path_len, std::string& rel_path)
+{
+    std::string decoded;
+    decoded.reserve(path_len);
+
+    for (size_t i = 0; i < path_len; ++i) {
+        if (path[i] == '%') {
+            int hi, lo;
+            if (i + 2 >= path_len || (hi = hex_value(path[i + 1])) < 0 || (lo = hex_value(path[i + 2])) < 0) {
+                return false;
+            }
+            decoded.push_back((char) (hi * 16 + lo));
+            i += 2;
+        } else {
+            decoded.push_back((char) path[i]);
+        }
+    }
+
+    /* rebuild the path segment by segment, "." and empty segments are dropped and ".." is refused */
+    rel_path.clear();
+    size_t begin = 0;
+    while (begin <= decoded.size()) {
+        size_t end = decoded.find('/', begin);
+        if (end == std::string::npos) end = decoded.size();
+
+        size_t len = end - begin;
+        if (len == 2 && decoded.compare(begin, 2, "..") == 0) {
+            return false;
+        }
+        if (len != 0 && !(len == 1 && decoded[begin] == '.')) {
+            if (decoded.find('\0', begin) < end) {
+                return false;
+            }
+            rel_path.push_back('/');
+            rel_path.append(decoded, begin, len);
+        }
+
+        begin = end + 1;
+    }
+
+    return true;
+}
+
+const char* StaticFiles::content_type(const std::string& path)
+{
+    auto dot = path.rfind('.');
+    auto slash = path.rfind('/');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        auto extension = path.c_str() + dot + 1;
+        for (auto& it : content_types) {
+            if (strcasecmp(it.extension, extension) == 0) {
+                return it.type;
+            }
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+StaticFiles::RangeStatus StaticFiles::parse_range(const ByteBuffer& value, size_t size, size_t& first, size_t& last)
+{
+    auto p = reinterpret_cast<const char*>(value.data());
+    auto end = p + value.size();
+
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) --end;
+
+    if (end - p < 6 || strncasecmp(p, "bytes=", 6) != 0) {
+        return RangeStatus::NONE;
+    }
+    p += 6;
+
+    /* only a single range is served, a multipart answer is not worth it; the full file is
+     * a valid response to a request for several ranges */
+    for (auto q = p; q < end; ++q) {
+        if (*q == ',') return RangeStatus::NONE;
+    }
+
+    auto parse_number = [&p, end](size_t& n) {
+        if (p == end || *p < '0' || *p > '9') return false;
+
+        n = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            size_t next = n * 10 + (size_t) (*p - '0');
+            if (next < n) return false;
+            n = next;
+            ++p;
+        }
+        return true;
+    };
+
+    if (p < end && *p == '-') {
+        /* suffix range, the last n bytes */
+        ++p;
+        size_t n;
+        if (!parse_number(n) || p != end) return RangeStatus::NONE;
+        if (n == 0 || size == 0) return RangeStatus::UNSATISFIABLE;
+
+        first = size - std::min(n, size);
+        last = size - 1;
+        return RangeStatus::SATISFIABLE;
+    }
+
+    if (!parse_number(first) || p == end || *p != '-') return RangeStatus::NONE;
+    ++p;
+
+    if (p == end) {
+        last = size - 1;
+    } else {
+        if (!parse_number(last) || p != end || last < first) return RangeStatus::NONE;
+        if (last >= size) last = size - 1;
+    }
+
+    if (first >= size) return RangeStatus::UNSATISFIABLE;
+    return RangeStatus::SATISFIABLE;
+}
+
+HttpResponse StaticFiles::serve(const HttpRequest& request, const uint8_t* path, size_t path_len) const
+{
+    std::string rel_path;
+    if (!resolve_path(path, path_len, rel_path)) {
+        return HttpConnection::make_error_response(404);
+    }
+
+    std::string full_path = root + rel_path;
+    std::shared_ptr<const OpenFile> file;
+    if (rel_path.empty() || path[path_len - 1] == '/') {
+        full_path += "/index.html";
+        file = cache->open(full_path);
+    } else {
+        file = cache->open(full_path);
+        if (!file && errno == EISDIR) {
+            full_path += "/index.html";
+            file = cache->open(full_path);
+        }
+    }
+
+    if (!file) {
+        return HttpConnection::make_error_response(404);
+    }
+
+    HttpResponse response;
+    response.status_code = 200;
+    response.headers.set(HeaderId::LAST_MODIFIED, file->last_modified, HTTP_DATE_LENGTH);
+    response.headers.set(HeaderId::OTHER, "Accept-Ranges", 13, "bytes", 5);
+
+    auto if_modified_since = request.headers.get(HeaderId::IF_MODIFIED_SINCE);
+    time_t since;
+    if (if_modified_since &&
+        parse_http_date(reinterpret_cast<const char*>(if_modified_since->data()), if_modified_since->size(), since) &&
+        file->st.st_mtime <= since) {
+        response.status_code = 304;
+        return response;
+    }
+
+    size_t size = (size_t) file->st.st_size;
+    size_t first = 0, last = size - 1;
+
+    auto content_type_value = content_type(full_path);
+    response.headers.set(HeaderId::CONTENT_TYPE, content_type_value, std::strlen(content_type_value));
+
+    auto range = request.headers.get(HeaderId::RANGE);
+    auto if_range = request.headers.get(HeaderId::IF_RANGE);
+    /* a stale If-Range turns the request into one for the whole file */
+    if (range && (!if_range || (if_range->size() == HTTP_DATE_LENGTH &&
+                                std::memcmp(if_range->data(), file->last_modified, HTTP_DATE_LENGTH) == 0))) {
+        switch (parse_range(*range, size, first, last)) {
+        case RangeStatus::NONE:
+            break;
+        case RangeStatus::SATISFIABLE: {
+            auto content_range = "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(size);
+            response.status_code = 206;
+            response.headers.set(HeaderId::OTHER, "Content-Range", 13, content_range.c_str(), content_range.size());
+            break;
+        }
+        case RangeStatus::UNSATISFIABLE: {
+            auto content_range = "bytes */" + std::to_string(size);
+            response.status_code = 416;
+            response.headers.set(HeaderId::OTHER, "Content-Range", 13, content_range.c_str(), content_range.size());
+            return response;
+        }
+        }
+    }
+
+    if (size != 0) {
+        response.file = std::move(file);
+        response.file_offset = first;
+        response.file_length = last - first + 1;
+    }
+
+    return response;
+}
@@ -0,0 +1,187 @@
+#include "supervisor.h"
+#include "easylogging++.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+constexpr std::chrono::seconds Supervisor::RESTART_DELAY;
+
+Supervisor::Supervisor(int nworkers, bool pin_cpus) : nworkers(nworkers), pin_cpus(pin_cpus)
+{
+    if (nworkers < 1) {
+        throw std::invalid_argument("at least one worker is required");
+    }
+
+    cpu_set_t cpuset;
+    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpuset)) cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) cpus.push_back(0);
+}
+
+int Supervisor::run(WorkerMain&& worker_main)
+{
+    this->worker_main = std::move(worker_main);
+
+    /* signals are taken synchronously, nothing runs in a signal handler */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+    auto now = std::chrono::steady_clock::now();
+    workers.assign(nworkers, Worker{-1, now, now});
+
+    bool stopping = false;
+    while (true) {
+        now = std::chrono::steady_clock::now();
+
+        bool restart_pending = false;
+        auto next_restart = std::chrono::steady_clock::time_point::max();
+        bool running = false;
+        for (int i = 0; i < nworkers; ++i) {
+            auto& worker = workers[i];
+
+            if (worker.pid == -1 && !stopping) {
+                if (worker.restart_at <= now) {
+                    spawn(i);
+                } else {
+                    restart_pending = true;
+                    next_restart = std::min(next_restart, worker.restart_at);
+                }
+            }
+
+            if (worker.pid != -1) running = true;
+        }
+
+        if (stopping && !running) break;
+
+        siginfo_t info;
+        int signo;
+        if (restart_pending) {
+            auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(next_restart - now);
+            struct timespec ts;
+            ts.tv_sec = (time_t) (timeout.count() / 1000000000);
+            ts.tv_nsec = (long) (timeout.count() % 1000000000);
+            signo = sigtimedwait(&mask, &info, &ts);
+        } else {
+            signo = sigwaitinfo(&mask, &info);
+        }
+
+        /* a timeout, a restart is due */
+        if (signo == -1) continue;
+
+        switch (signo) {
+        case SIGCHLD:
+            reap(stopping);
+            break;
+        case SIGHUP:
+            /* the workers exit and are started again, loading the script anew */
+            LOG(INFO) << "Restarting workers";
+            signal_workers(SIGHUP);
+            break;
+        default:
+            if (!stopping) {
+                LOG(INFO) << "Stopping workers";
+                stopping = true;
+            }
+            signal_workers(signo);
+            break;
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+    return 0;
+}
+
+void Supervisor::spawn(int index)
+{
+    auto& worker = workers[index];
+    pid_t supervisor_pid = getpid();
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        LOG(ERROR) << "failed to fork worker " << index << "(" << errno << ")";
+        worker.restart_at = std::chrono::steady_clock::now() + RESTART_DELAY;
+        return;
+    }
+
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+
+        /* workers do not outlive the supervisor, even if it is killed without a chance to stop them */
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != supervisor_pid) {
+            _exit(0);
+        }
+
+        if (pin_cpus) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpus[index % cpus.size()], &cpuset);
+            if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1) {
+                LOG(WARNING) << "failed to pin worker " << index << "(" << errno << ")";
+            }
+        }
+
+        int status;
+        try {
+            status = worker_main(index);
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "Worker " << index << ": " << e.what();
+            status = 1;
+        }
+
+        /* the supervisor's atexit handlers and static objects are not the worker's to run */
+        _exit(status);
+    }
+
+    worker.pid = pid;
+    worker.started = std::chrono::steady_clock::now();
+    LOG(INFO) << "Started worker " << index << " (pid " << pid << ")";
+}
+
+void Supervisor::reap(bool stopping)
+{
+    int status;
+    pid_t pid;
+
+    /* several exits may have been reported by a single SIGCHLD */
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto it = std::find_if(workers.begin(), workers.end(), [pid](const Worker& w) { return w.pid == pid; });
+        if (it == workers.end()) continue;
+
+        int index = (int) (it - workers.begin());
+        if (!stopping) {
+            if (WIFSIGNALED(status)) {
+                LOG(WARNING) << "Worker " << index << " (pid " << pid << ") was killed by signal " << WTERMSIG(status);
+            } else {
+                LOG(WARNING) << "Worker " << index << " (pid " << pid << ") exited with status " << WEXITSTATUS(status);
+            }
+        }
+
+        /* a worker that fails right away, for example on a broken script, is not restarted in a tight loop */
+        auto now = std::chrono::steady_clock::now();
+        it->pid = -1;
+        it->restart_at = (now - it->started < RESTART_DELAY) ? now + RESTART_DELAY : now;
+    }
+}
+
+void Supervisor::signal_workers(int signo)
+{
+    for (auto& worker : workers) {
+        if (worker.pid != -1) {
+            kill(worker.pid, signo);
+        }
+    }
+}
@@ -0,0 +1,489 @@
+#include "uring_backend.h"
+#include "completion_queue.h"
+#include "http_connection.h"
+#include "reactor.h"
+#include "easylogging++.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+UringBackend::UringBackend(Reactor* reactor, int listen_fd, CompletionQueue* completions)
+    : reactor(reactor), listen_fd(listen_fd), completions(completions), ring_fd(-1), ring_mem(MAP_FAILED),
+      ring_size(0), sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_size(0), sq_tail(0),
+      buf_ring(static_cast<struct io_uring_buf_ring*>(MAP_FAILED)), buf_ring_size(0),
+      recv_buffers(static_cast<uint8_t*>(MAP_FAILED)), buf_tail(0)
+{
+    /* Only the reactor thread submits and the completions are only processed when it waits for them.
+     * The ring starts disabled and is enabled from the reactor thread, which makes it the submitter. */
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+    /* every connection may have a receive, a send and a close outstanding */
+    params.cq_entries = RING_ENTRIES * 4;
+
+    ring_fd = io_uring_setup(RING_ENTRIES, &params);
+    if (ring_fd == -1) {
+        throw Unavailable("io_uring_setup failed(" + std::to_string(errno) + ")");
+    }
+
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_SUBMIT_STABLE |
+                              IORING_FEAT_FAST_POLL;
+    if ((params.features & required) != required) {
+        ::close(ring_fd);
+        throw Unavailable("io_uring lacks required features");
+    }
+
+    ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                         params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    ring_mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                    IORING_OFF_SQ_RING);
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+
+    buf_ring_size = RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    buf_ring = static_cast<struct io_uring_buf_ring*>(mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    recv_buffers = static_cast<uint8_t*>(mmap(nullptr, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+    if (ring_mem == MAP_FAILED || sqes == MAP_FAILED || buf_ring == MAP_FAILED || recv_buffers == MAP_FAILED) {
+        teardown();
+        throw std::runtime_error("cannot map io_uring");
+    }
+
+    auto base = static_cast<uint8_t*>(ring_mem);
+    sq_khead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_ktail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_entries = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_entries);
+    cq_khead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_ktail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+
+    /* entries are queued in order, the indirection array stays the identity */
+    auto array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; ++i) {
+        array[i] = i;
+    }
+    sq_tail = *sq_ktail;
+
+    struct io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = RECV_BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        int err = errno;
+        teardown();
+        throw Unavailable("cannot register provided buffers(" + std::to_string(err) + ")");
+    }
+
+    for (unsigned bid = 0; bid < RECV_BUFFER_COUNT; ++bid) {
+        recycle_buffer((uint16_t) bid);
+    }
+}
+
+UringBackend::~UringBackend()
+{
+    teardown();
+}
+
+void UringBackend::teardown()
+{
+    /* takes down whatever is still in flight */
+    if (ring_fd != -1) {
+        ::close(ring_fd);
+    }
+
+    if (recv_buffers != MAP_FAILED) munmap(recv_buffers, RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+    if (buf_ring != MAP_FAILED) munmap(buf_ring, buf_ring_size);
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (ring_mem != MAP_FAILED) munmap(ring_mem, ring_size);
+    ring_fd = -1;
+    recv_buffers = static_cast<uint8_t*>(MAP_FAILED);
+    buf_ring = static_cast<struct io_uring_buf_ring*>(MAP_FAILED);
+    sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    ring_mem = MAP_FAILED;
+}
+
+void UringBackend::start()
+{
+    if (io_uring_register(ring_fd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) == -1) {
+        throw std::runtime_error("cannot enable io_uring");
+    }
+
+    arm_accept();
+    arm_wakeup();
+}
+
+void UringBackend::poll()
+{
+    /* everything queued while handling the last round goes in with the wait for the next one */
+    submit(1);
+
+    unsigned head = *cq_khead;
+    unsigned tail = __atomic_load_n(cq_ktail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        auto& cqe = cqes[head & cq_mask];
+        handle_completion(cqe.user_data, cqe.res, cqe.flags);
+    }
+
+    __atomic_store_n(cq_khead, head, __ATOMIC_RELEASE);
+}
+
+void UringBackend::reserve(unsigned count)
+{
+    unsigned head = __atomic_load_n(sq_khead, __ATOMIC_ACQUIRE);
+    if (sq_tail - head + count > sq_entries) {
+        submit(0);
+    }
+}
+
+struct io_uring_sqe* UringBackend::get_sqe()
+{
+    reserve(1);
+
+    auto sqe = &sqes[sq_tail & sq_mask];
+    sq_tail++;
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+void UringBackend::submit(unsigned wait_nr)
+{
+    __atomic_store_n(sq_ktail, sq_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sq_tail - __atomic_load_n(sq_khead, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0) return;
+
+    int ret = io_uring_enter(ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        throw std::runtime_error("io_uring_enter failed");
+    }
+
+    /* the kernel has copied the messages of every send it has taken */
+    if (__atomic_load_n(sq_khead, __ATOMIC_ACQUIRE) == sq_tail) {
+        send_messages.clear();
+    }
+}
+
+void UringBackend::handle_completion(uint64_t user_data, int32_t res, uint32_t flags)
+{
+    auto op = static_cast<Op>(user_data & OP_MASK);
+    auto conn = reinterpret_cast<HttpConnection*>(user_data & ~OP_MASK);
+
+    switch (op) {
+    case ACCEPT:
+        if (res >= 0) {
+            reactor->accept_connection(res);
+        } else {
+            LOG(ERROR) << "accept error(" << -res << ")";
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+            arm_accept();
+        }
+        break;
+
+    case WAKEUP:
+        /* responses and stream pieces from the workers, written out right away */
+        completions->drain();
+        if (!(flags & IORING_CQE_F_MORE)) {
+            arm_wakeup();
+        }
+        break;
+
+    case RECV:
+        handle_recv(conn, res, flags);
+        break;
+
+    case SEND:
+        handle_send(conn, res);
+        break;
+
+    case POLL_OUT:
+        conn->get_io_state().writing = false;
+        if (!conn->is_closed()) {
+            if (res < 0) {
+                conn->close();
+            } else {
+                conn->handle_written(0);
+            }
+        }
+        conn->release();
+        break;
+
+    case CLOSE:
+        if (res < 0 && res != -ECANCELED) {
+            LOG(DEBUG) << "close error(" << -res << "), fd = " << conn->get_fd();
+        }
+        conn->release();
+        break;
+
+    case CANCEL:
+        break;
+    }
+}
+
+void UringBackend::arm_accept()
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = make_user_data(nullptr, ACCEPT);
+}
+
+void UringBackend::arm_wakeup()
+{
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = completions->get_fd();
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = make_user_data(nullptr, WAKEUP);
+}
+
+void UringBackend::add_connection(HttpConnection* conn)
+{
+    arm_recv(conn);
+}
+
+void UringBackend::arm_recv(HttpConnection* conn)
+{
+    /* the receive holds a reference until its last completion */
+    conn->retain();
+    conn->get_io_state().receiving = true;
+
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->get_fd();
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = make_user_data(conn, RECV);
+}
+
+void UringBackend::handle_recv(HttpConnection* conn, int32_t res, uint32_t flags)
+{
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+        if (res > 0 && !conn->is_closed()) {
+            conn->handle_input(recv_buffers + bid * RECV_BUFFER_SIZE, (size_t) res);
+        }
+        /* the data has been copied out, the buffer goes straight back to the ring */
+        recycle_buffer(bid);
+    }
+
+    if (res == 0) {
+        if (!conn->is_closed()) {
+            conn->handle_input(nullptr, 0);
+        }
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED && !conn->is_closed()) {
+        LOG(DEBUG) << "io read error(" << -res << "), fd = " << conn->get_fd();
+        conn->close();
+    }
+
+    if (flags & IORING_CQE_F_MORE) return;
+
+    /* A receive that ran out of buffers or stopped for other reasons of the kernel's is started again,
+     * and so is one cancelled by pause_input if the input has been resumed since. */
+    conn->get_io_state().receiving = false;
+    if (!conn->is_closed() && !conn->is_input_paused() && (res > 0 || res == -ENOBUFS || res == -ECANCELED)) {
+        arm_recv(conn);
+    }
+    conn->release();
+}
+
+ssize_t UringBackend::write(HttpConnection* conn, OutputQueue& out, bool last)
+{
+    auto& io = conn->get_io_state();
+    /* carried on by handle_written once the write in flight has completed */
+    if (io.writing || io.closing) return 0;
+
+    int fd = conn->get_fd();
+    ssize_t total = 0;
+
+    /* file regions still go out with sendfile, the ring only waits for the socket to take more */
+    while (out.front_is_file()) {
+        ssize_t nwritten = out.send_file(fd);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_writable(conn);
+                return total;
+            }
+            return -1;
+        }
+
+        out.consume((size_t) nwritten);
+        total += nwritten;
+    }
+    if (out.empty()) return total;
+
+    /* room for the send and a close linked to it, which must go in together; queued before the message,
+     * submitting what is queued does away with the earlier messages */
+    reserve(3);
+
+    send_messages.emplace_back();
+    auto& message = send_messages.back();
+    size_t nbytes;
+    int iovcnt = out.gather(message.iov, nbytes);
+    std::memset(&message.msg, 0, sizeof(message.msg));
+    message.msg.msg_iov = message.iov;
+    message.msg.msg_iovlen = iovcnt;
+
+    bool more = nbytes < out.size();
+    bool link_close = last && !more;
+
+    conn->retain();
+    io.writing = true;
+    io.write_size = nbytes;
+
+    /* MSG_WAITALL has the kernel retry a partial send by itself, the send only completes short on errors */
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&message.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (more ? MSG_MORE : 0);
+    sqe->user_data = make_user_data(conn, SEND);
+
+    if (link_close) {
+        sqe->flags |= IOSQE_IO_LINK;
+        io.close_linked = true;
+        queue_close(conn);
+    }
+
+    return total;
+}
+
+void UringBackend::handle_send(HttpConnection* conn, int32_t res)
+{
+    auto& io = conn->get_io_state();
+    io.writing = false;
+
+    bool complete = res >= 0 && (size_t) res == io.write_size;
+    if (io.close_linked) {
+        io.close_linked = false;
+        /* a send that falls short breaks the link, the close is cancelled along with it */
+        if (!complete) {
+            io.closing = false;
+            if (conn->is_closed()) {
+                queue_close(conn);
+            }
+        }
+    }
+
+    if (!conn->is_closed()) {
+        if (res < 0) {
+            LOG(DEBUG) << "io write error(" << -res << "), fd = " << conn->get_fd();
+            conn->close();
+        } else {
+            conn->handle_written((size_t) res);
+        }
+    }
+    conn->release();
+}
+
+void UringBackend::wait_writable(HttpConnection* conn)
+{
+    conn->retain();
+    conn->get_io_state().writing = true;
+
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->get_fd();
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = make_user_data(conn, POLL_OUT);
+}
+
+void UringBackend::pause_input(HttpConnection* conn)
+{
+    if (!conn->get_io_state().receiving) return;
+
+    /* what is already on its way is still delivered, the final completion tells the receive has stopped */
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = make_user_data(conn, RECV);
+    sqe->user_data = make_user_data(nullptr, CANCEL);
+}
+
+void UringBackend::resume_input(HttpConnection* conn)
+{
+    /* a receive still winding down is started again by its final completion */
+    if (conn->get_io_state().receiving) return;
+
+    arm_recv(conn);
+}
+
+void UringBackend::close(HttpConnection* conn)
+{
+    /* already on its way, after the last send */
+    if (conn->get_io_state().closing) return;
+
+    queue_close(conn);
+}
+
+void UringBackend::queue_close(HttpConnection* conn)
+{
+    reserve(2);
+
+    conn->retain();
+    conn->get_io_state().closing = true;
+
+    /* The receive holds on to the socket, and so would a send waiting for room, so they are cancelled
+     * first. The close goes ahead whether or not there was anything to cancel. */
+    auto cancel = get_sqe();
+    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+    cancel->fd = conn->get_fd();
+    cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    cancel->flags = IOSQE_IO_HARDLINK;
+    cancel->user_data = make_user_data(nullptr, CANCEL);
+
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->get_fd();
+    sqe->user_data = make_user_data(conn, CLOSE);
+}
+
+void UringBackend::recycle_buffer(uint16_t bid)
+{
+    /* The tail shares its place with the first entry's reserved field, the entries are filled in field by
+     * field. bufs is not used, the flexible array is moved past an empty struct when compiled as C++. */
+    auto& buf = reinterpret_cast<struct io_uring_buf*>(buf_ring)[buf_tail & (RECV_BUFFER_COUNT - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(recv_buffers + bid * RECV_BUFFER_SIZE);
+    buf.len = RECV_BUFFER_SIZE;
+    buf.bid = bid;
+
+    buf_tail++;
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}